@@ -10,17 +10,23 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <EFM8LB1.h>
+#include "goertzel.h"
+#include "harmonics.h"
+#include "power.h"
+#include "fixfmt.h"
+#include "serial.h"
+#include "measure.h"
+#include "scope.h"
+#include "multi.h"
+#include "pq.h"
+#include "../COMMON_EFM8LB1/timebase.h"
 
 // ~C51~
 
 #define BAUDRATE 115200L
-#define SARCLK   18000000L
 
-#define CH1 QFP32_MUX_P2_1  // ADC input on P2.1
-#define CH2 QFP32_MUX_P2_2  // ADC input on P2.2 (REFERENCE signal)
-
-#define SYSCLK       72000000L
 #define TIMER_0_FREQ 1000L
 #define TIMER_1_FREQ 2000L
 
@@ -36,9 +42,45 @@
 #define LCD_D7 P1_0
 #define CHARS_PER_LINE 16
 
-#define THRESH1 0.05  // CH1 threshold (large ~2.1V peak)
-#define THRESH2 0.02  // CH2 threshold (smaller ~0.77V peak)
-#define VDD 3.3
+// Goertzel estimator (see goertzel.h).  The inputs are half-wave rectified,
+// so the fundamental is half of the peak.  Blocks come from Capture_Block()
+// in measure.c.
+#define GZ_PEAK_SCALE    2.0
+
+// Display modes, selected by pressing a key in PuTTY
+#define MODE_PHASE     0  // 'p': frequency, RMS and phase (default)
+#define MODE_HARMONICS 1  // 'h': THD and harmonics 2..HARM_MAX
+#define MODE_POWER     2  // 'w': P, Q, S, PF and energy ('z' zeroes energy)
+#define MODE_SCOPE     3  // 's': binary waveform frames at SCOPE_BAUD (scope.h)
+#define MODE_MULTI     4  // 'm': RMS, frequency and phase of P2.1 .. P2.5
+#define MODE_EVENTS    5  // 'v': power-quality event log (pq.h)
+#define MODE_BAR       6  // 'b': LCD bargraph of CH1, CH2 or the phase
+#define HARM_HALFWAVE  1  // Inputs are half-wave rectified (see harmonics.c)
+#define HARM_WAIT      200 // ms between harmonic reports
+#define PWR_WAIT       200 // ms between power reports
+#define MULTI_GAP      40  // ms at least between multi-channel report starts:
+                           // one takes ~30 ms of serial at 115200
+#define EVENTS_WAIT    200 // ms between event log reports
+#define NOSIG_WAIT     500 // ms between screens while a channel is missing
+
+// Bargraph mode: line 1 is a bar of 5 steps per cell (CGRAM glyphs),
+// redrawn every BAR_FRAME_MS between readings; line 2 and the serial
+// report follow each reading
+#define BAR_FRAME_MS   30
+#define BAR_FRAMES     16  // Per reading: ~0.65 s at 60 Hz, ~25 frames/s
+#define BAR_CELLS      CHARS_PER_LINE
+#define BAR_STEPS      (BAR_CELLS * 5)
+#define BAR_FULL_V     (VDD / 1.41421356237)  // RMS of the largest sine the ADC reads
+#define BAR_NONE       0xFE  // Shadow: cell contents not known
+#define BAR_CH1        0
+#define BAR_CH2        1
+#define BAR_PHASE      2
+
+// Power metering: CH1 is the voltage sense and CH2 the current sense.
+// Calibrate for the front end: line volts per volt at P2.1 (divider
+// ratio) and amps per volt at P2.2 (1 / (shunt * gain)).
+#define PWR_V_SCALE 1.0
+#define PWR_I_SCALE 1.0
 
 
 char _c51_external_startup (void)
@@ -101,6 +143,10 @@ char _c51_external_startup (void)
 	TMR2    = 0x0000;
 	ET2     = 0;
 
+	// Timer 3 - shared timebase (timebase.c): LCD and report delays,
+	// measurement deadlines, edge timestamps and energy integration
+	Timebase_Init();
+
 	EA = 1;
 	return 0;
 }
@@ -124,33 +170,10 @@ void Timer1_ISR (void) interrupt INTERRUPT_TIMER1
 // LCD functions
 // ----------------------------------------------------------------
 
-void Timer3us (unsigned char us)
-{
-	unsigned char i;
-	CKCON0 |= 0b_0100_0000;
-	TMR3RL  = (-(SYSCLK)/1000000L);
-	TMR3    = TMR3RL;
-	TMR3CN0 = 0x04;
-	for (i = 0; i < us; i++)
-	{
-		while (!(TMR3CN0 & 0x80));
-		TMR3CN0 &= ~(0x80);
-	}
-	TMR3CN0 = 0;
-}
-
-void waitms (unsigned int ms)
-{
-	unsigned int j;
-	unsigned char k;
-	for (j = 0; j < ms; j++)
-		for (k = 0; k < 4; k++) Timer3us(250);
-}
-
 void LCD_pulse (void)
 {
 	LCD_E = 1;
-	Timer3us(40);
+	Delay_us(40);
 	LCD_E = 0;
 }
 
@@ -159,7 +182,7 @@ void LCD_byte (unsigned char x)
 	ACC = x;
 	LCD_D7 = ACC_7; LCD_D6 = ACC_6; LCD_D5 = ACC_5; LCD_D4 = ACC_4;
 	LCD_pulse();
-	Timer3us(40);
+	Delay_us(40);
 	ACC = x;
 	LCD_D7 = ACC_3; LCD_D6 = ACC_2; LCD_D5 = ACC_1; LCD_D4 = ACC_0;
 	LCD_pulse();
@@ -201,60 +224,575 @@ void LCDprint (char *string, unsigned char line, bit clear)
 	if (clear) for (; j < CHARS_PER_LINE; j++) WriteData(' ');
 }
 
+// A data (rs = 1) or address byte at the controller's own pace, about
+// 40us, instead of the milliseconds WriteData() and WriteCommand() allow
+void LCD_Fast (bit rs, unsigned char x)
+{
+	LCD_RS = rs;
+	LCD_byte(x);
+	Delay_us(50);
+}
+
+// CGRAM glyphs 0-3 light the left 1-4 columns of a cell, 4-7 the right
+// 1-4; the bottom (cursor) row stays dark
+void LCD_Bar_Glyphs (void)
+{
+	unsigned char g, row, bits;
+
+	LCD_Fast(0, 0x40);  // CGRAM address 0
+	for (g = 0; g < 8; g++)
+	{
+		bits = (g < 4) ? (0x1F << (4 - g)) & 0x1F : 0x1F >> (8 - g);
+		for (row = 0; row < 8; row++) LCD_Fast(1, (row < 7) ? bits : 0);
+	}
+	LCD_Fast(0, 0x80);  // Back to DDRAM
+}
+
+
+// ----------------------------------------------------------------
+// Analysis results
+// ----------------------------------------------------------------
+
+// XRAM: ~140 bytes of harmonic results and 64 bytes of coefficients
+// (harmonics.c) next to the sample blocks of measure.c, well inside the 4 KB.
+xdata harm_result harm1, harm2;
+xdata pwr_result  pwr;
+xdata pwr_energy  energy;
+xdata multi_result multi;
+xdata pq_event  pq_ev;
+xdata pq_status pq_st;
+xdata unsigned char bar_shadow[BAR_CELLS];  // What line 1 shows in bargraph mode
+unsigned char bar_src = BAR_CH1;
+float bar_v[2], bar_phase;        // The last reading's V_RMS and Goertzel phase
+unsigned int  bar_frames, bar_writes;  // Since the last report
+unsigned long bar_ticks;          // Ticks() at the last report
+unsigned long energy_ticks; // Ticks() at the last energy update
+unsigned long multi_ticks;  // Ticks() at the last multi-channel report
+bit energy_valid;           // energy_ticks is meaningful
+unsigned char meter_mode = MODE_PHASE;
+bit edge_window;            // Edges timed by the ADC window comparator
+bit freq_lock;              // Blocks paced by the frequency lock (measure.c)
+unsigned long nosig_ticks;  // Ticks() of the last screen with a channel missing
+bit tx_overwrite;           // A full serial queue loses its oldest text, else the newest
+
 
 // ----------------------------------------------------------------
-// ADC functions
+// Display modes, harmonic analysis and power
 // ----------------------------------------------------------------
 
-void InitADC (void)
+// Entering bargraph mode: the glyphs, and every cell written at the
+// first frame
+void Bar_Start (void)
 {
-	SFRPAGE = 0x00;
-	ADEN = 0;
+	unsigned char i;
 
-	ADC0CN1 =
-		(0x2 << 6) | // 14-bit
-		(0x0 << 3) |
-		(0x0 << 0) ;
+	LCD_Bar_Glyphs();
+	for (i = 0; i < BAR_CELLS; i++) bar_shadow[i] = BAR_NONE;
+	bar_frames = bar_writes = 0;
+	bar_ticks = Ticks();
+}
 
-	ADC0CF0 = ((SYSCLK/SARCLK) << 3) | (0x0 << 2);
-	ADC0CF1 = (0 << 7) | (0x1E << 0);
-	ADC0CN0 = 0x00;
+// Line 1 as a bar 'steps' columns long from the left edge, or with
+// center set from the middle: to the right if steps > 0, to the left if
+// steps < 0.  Only the cells that change are written, and the address
+// only where the controller's own increment does not get there.
+void Bar_Draw (int steps, bit center)
+{
+	unsigned char i, c, next = 0xFF;
+	int k;
 
-	ADC0CF2 =
-		(0x0 << 7) |
-		(0x1 << 5) | // reference = VDD
-		(0x1F << 0);
+	for (i = 0; i < BAR_CELLS; i++)
+	{
+		// k: columns of this cell that are lit, counted from the bar's start
+		if (!center) k = steps - 5 * i;
+		else if (i >= BAR_CELLS / 2) k = steps - 5 * (i - BAR_CELLS / 2);
+		else k = -steps - 5 * (BAR_CELLS / 2 - 1 - i);
+
+		if (k <= 0) c = ' ';
+		else if (k >= 5) c = 0xFF;  // Full block in the character ROM
+		else if (center && i < BAR_CELLS / 2) c = 3 + k;
+		else c = k - 1;
+
+		if (c == bar_shadow[i]) continue;
+		if (i != next) LCD_Fast(0, 0x80 + i);
+		LCD_Fast(1, c);
+		bar_shadow[i] = c;
+		next = i + 1;
+		bar_writes++;
+	}
+}
+
+// One frame: CH1 or CH2 from the latest RMS(1/2) of pq.c, which is new
+// every half-cycle, and the phase from its last cycle's crossings
+// (pq_phase()); the last reading's value while pq.c has none.
+void Bar_Frame (void)
+{
+	float v;
 
-	ADC0CN2 = 0x00;
-	ADEN = 1;
+	if (bar_src == BAR_PHASE)
+	{
+		if (!pq_phase(&v)) v = bar_phase;
+		Bar_Draw((int)fmt_scale(v * (BAR_STEPS / 2) / 180.0, 0), 1);
+	}
+	else
+	{
+		pq_get_status(&pq_st);
+		if (pq_st.running && pq_st.rms[bar_src] != PQ_FLAGGED) v = pq_volts(pq_st.rms[bar_src]);
+		else v = bar_v[bar_src];
+		if (v > BAR_FULL_V) v = BAR_FULL_V;
+		Bar_Draw((int)fmt_scale(v * BAR_STEPS / BAR_FULL_V, 0), 0);
+	}
+	bar_frames++;
 }
 
-void InitPinADC (unsigned char portno, unsigned char pinno)
+// One key: a display mode, a measurement setting, or else a scope
+// setting (scope.c) and an event detector setting (pq.c)
+void Mode_Key (char c)
 {
-	unsigned char mask = 1 << pinno;
-	SFRPAGE = 0x20;
-	switch (portno)
+	unsigned char mode = meter_mode;
+
+	switch (c)
 	{
-		case 0: P0MDIN &= (~mask); P0SKIP |= mask; break;
-		case 1: P1MDIN &= (~mask); P1SKIP |= mask; break;
-		case 2: P2MDIN &= (~mask); P2SKIP |= mask; break;
-		default: break;
+		case 'p': case 'P': mode = MODE_PHASE;     break;
+		case 'h': case 'H': mode = MODE_HARMONICS; break;
+		case 'w': case 'W': mode = MODE_POWER;     break;
+		case 's': case 'S': mode = MODE_SCOPE;     break;
+		case 'm': case 'M': mode = MODE_MULTI;     break;
+		case 'v': case 'V': mode = MODE_EVENTS;    break;
+		case 'b': case 'B':
+			if (meter_mode == MODE_BAR) bar_src = (bar_src + 1) % 3;
+			mode = MODE_BAR;
+			break;
+		case 'z': case 'Z': pwr_energy_reset(&energy); break;
+		case 'e': case 'E':
+			edge_window = !edge_window;
+			if (!edge_window) Window_Stop();
+			break;
+		case 'k': case 'K':
+			freq_lock = !freq_lock;
+			if (freq_lock) Lock_Reset();
+			break;
+		case 'r': case 'R':
+			// Cycle the edge profile; a window run takes it at its next start
+			meas_edge = (meas_edge == ADC_AMPL)   ? ADC_EDGE12 :
+			            (meas_edge == ADC_EDGE12) ? ADC_EDGE10 : ADC_AMPL;
+			break;
+		case 'a': case 'A':
+			meas_block = (meas_block == ADC_AMPL) ? ADC_ACC4 :
+			             (meas_block == ADC_ACC4) ? ADC_ACC16 : ADC_AMPL;
+			break;
+		case 'o': case 'O':
+			tx_overwrite = !tx_overwrite;
+			serial_policy(tx_overwrite ? SERIAL_OVERWRITE : SERIAL_DROP);
+			break;
+		default:
+			Scope_Key(c);
+			pq_key(c);
+			return;
 	}
-	SFRPAGE = 0x00;
+	if (mode != meter_mode)
+	{
+		// serial_baud() lets the queued text go out at the old rate first
+		if (meter_mode == MODE_SCOPE) serial_baud(BAUDRATE);
+		meter_mode = mode;
+		// Only the multi-channel screen pays for scanning CH3 .. CH5
+		scan_n = (mode == MODE_MULTI) ? SCAN_MAX : 2;
+		if (mode == MODE_MULTI) multi_reset();
+		if (mode == MODE_BAR) Bar_Start();
+		if (mode == MODE_SCOPE)
+		{
+			fmt_puts("\x1b[2J\x1b[HScope mode: binary frames at 3 Mbaud (host/scope_rx),\n"
+			         "send 'p' at that rate to return\n");
+			serial_baud(SCOPE_BAUD);
+			LCDprint("Scope mode", 1, 1);
+			LCDprint("UART 3 Mbaud", 2, 1);
+		}
+		else fmt_puts("\x1b[2J");
+	}
+}
+
+// Non-blocking: handles the keys the UART0 ISR has queued, if any
+void Check_Mode_Key (void)
+{
+	char c;
+
+	while ((c = serial_getkey()) != 0) Mode_Key(c);
+}
+
+char *Profile_Name (unsigned char p)
+{
+	switch (p)
+	{
+		case ADC_EDGE12: return "12-bit";
+		case ADC_EDGE10: return "10-bit";
+		case ADC_ACC4:   return "14-bit x4";
+		case ADC_ACC16:  return "12-bit x16";
+		default:         return "14-bit";
+	}
+}
+
+// "<label><x><unit>" on the serial port, x printed like "%<w>.<dp>f"
+void Report_Field (char *label, float x, unsigned char w, unsigned char dp,
+                   unsigned char flags, char *unit)
+{
+	char buf[16];
+
+	fmt_puts(label);
+	fmt_fix(buf, fmt_scale(x, dp), w, dp, flags);
+	fmt_puts(buf);
+	fmt_puts(unit);
+}
+
+float Harm_Pct (harm_result *r, unsigned char h)
+{
+	return (r->mag[1] > 0) ? 100.0 * r->mag[h] / r->mag[1] : 0;
+}
+
+// A percentage for the LCD with one decimal, saturated at max so that a
+// noise channel (THD of thousands of %) still fits its columns
+char *Lcd_Pct (char *p, float pct, float max, unsigned char width)
+{
+	return fmt_fix(p, fmt_scale((pct < max) ? pct : max, 1), width, 1, 0);
+}
+
+// The harmonics and power screens need both channels
+void Lcd_No_Signal (unsigned char status)
+{
+	LCDprint((status & MEAS_CH1) ? "CH2 No signal" : "CH1 No signal", 1, 1);
+	LCDprint(status ? "" : "CH2 No signal", 2, 1);
+}
+
+/*
+ * The captured block through the harmonic bank (about 20 ms of math),
+ * then the report:
+ *
+ * Line 1: "THD  4.3%   1.2%"   CH1 THD, CH2 THD
+ * Line 2: "H3  2.1 H5  1.0%"   CH1's two largest harmonics
+ */
+void Harmonics_Report (unsigned char status, bit captured, float f0)
+{
+	unsigned char h;
+	char *p;
+	char lcd1[17];
+	char lcd2[17];
+
+	if (status != (MEAS_CH1 | MEAS_CH2))
+	{
+		Lcd_No_Signal(status);
+		return;
+	}
+	if (!captured)
+	{
+		LCDprint("THD: freq range", 1, 1);
+		LCDprint("3Hz-1kHz only", 2, 1);
+		return;
+	}
+
+	harm_analyze(&harm1, gz_buf1, GZ_N, HARM_HALFWAVE);
+	harm_analyze(&harm2, gz_buf2, GZ_N, HARM_HALFWAVE);
+
+	fmt_puts("\x1b[H");
+	Report_Field("Harmonics, f0 = ", f0, 7, 3, 0, " Hz      \n");
+	Report_Field("  THD:  CH1 ", harm1.thd, 6, 2, 0, " %   CH2 ");
+	Report_Field("", harm2.thd, 6, 2, 0, " %   \n\n");
+	fmt_puts("   n    CH1 V_PEAK   CH1 %   CH2 V_PEAK   CH2 %\n");
+	for (h = 1; h <= HARM_MAX; h++)
+	{
+		fmt_uint(lcd1, h, 4);
+		fmt_puts(lcd1);
+		Report_Field("    ", harm1.mag[h] * VDD / 0b_0011_1111_1111_1111, 8, 5, 0, "");
+		Report_Field(" ", Harm_Pct(&harm1, h), 7, 2, 0, "");
+		Report_Field("    ", harm2.mag[h] * VDD / 0b_0011_1111_1111_1111, 8, 5, 0, "");
+		Report_Field(" ", Harm_Pct(&harm2, h), 7, 2, 0, "\n");
+	}
+
+	p = fmt_str(lcd1, "THD");
+	p = Lcd_Pct(p, harm1.thd, 999.9, 5);
+	p = fmt_str(p, "%");
+	p = Lcd_Pct(p, harm2.thd, 999.9, 6);
+	fmt_str(p, "%");
+	p = lcd2;
+	for (h = 0; h < 2; h++)
+	{
+		p = fmt_str(p, h ? " H" : "H");
+		p = fmt_uint(p, harm1.top[h], 0);
+		if (harm1.top[h] < 10)
+			p = Lcd_Pct(p, Harm_Pct(&harm1, harm1.top[h]), 999.9, 5);
+		else
+			p = Lcd_Pct(p, Harm_Pct(&harm1, harm1.top[h]), 99.9, 4);
+	}
+	fmt_str(p, "%");
+	LCDprint(lcd1, 1, 1);
+	LCDprint(lcd2, 2, 1);
+}
+
+// Power of the captured block, integrated into the energy total over the
+// time since the previous block.  Runs every loop whatever the display
+// mode, so the energy keeps counting while other screens are shown.
+// Time with no usable capture (no signal, frequency out of range) is not
+// counted.
+void Update_Energy (bit captured)
+{
+	unsigned long now = Ticks();
+
+	if (!captured)
+	{
+		energy_valid = 0;
+		return;
+	}
+	pwr_analyze(&pwr, gz_buf1, gz_buf2, GZ_N,
+	            PWR_V_SCALE * VDD / 0b_0011_1111_1111_1111,
+	            PWR_I_SCALE * VDD / 0b_0011_1111_1111_1111);
+	if (energy_valid)
+		pwr_energy_add(&energy, pwr.p, (float)(now - energy_ticks) * ((float)12 / SYSCLK));
+	energy_ticks = now;
+	energy_valid = 1;
+}
+
+/*
+ * Line 1: "P 123.4W PF 0.98"   real power, power factor
+ * Line 2: "E     12.345 Wh"   energy since reset ('z')
+ */
+void Power_Report (unsigned char status, bit captured, float f0)
+{
+	char *p;
+	char lcd1[17];
+	char lcd2[17];
+
+	if (status != (MEAS_CH1 | MEAS_CH2))
+	{
+		Lcd_No_Signal(status);
+		return;
+	}
+	if (!captured)
+	{
+		LCDprint("PWR: freq range", 1, 1);
+		LCDprint("3Hz-1kHz only", 2, 1);
+		return;
+	}
+
+	fmt_puts("\x1b[H");
+	Report_Field("Power (CH1 = V, CH2 = I), f0 = ", f0, 7, 3, 0, " Hz   \n\n");
+	Report_Field("  V_RMS:  ", pwr.vrms, 10, 4, 0, " V      \n");
+	Report_Field("  I_RMS:  ", pwr.irms, 10, 4, 0, " A      \n");
+	Report_Field("  P:      ", pwr.p, 10, 4, 0, " W      \n");
+	Report_Field("  Q:      ", pwr.q, 10, 4, FMT_PLUS, " var    \n");
+	Report_Field("  S:      ", pwr.s, 10, 4, 0, " VA     \n");
+	Report_Field("  PF:     ", pwr.pf, 10, 4, 0, pwr.q >= 0 ? " lagging \n" : " leading \n");
+	Report_Field("  Energy: ", pwr_energy_wh(&energy), 10, 4, 0, " Wh     \n");
+
+	p = fmt_str(lcd1, "P");
+	p = fmt_fix(p, fmt_scale(pwr.p, 1), 6, 1, 0);
+	p = fmt_str(p, "W PF");
+	fmt_fix(p, fmt_scale(pwr.pf, 2), 5, 2, 0);
+	p = fmt_str(lcd2, "E");
+	p = fmt_fix(p, fmt_scale(pwr_energy_wh(&energy), 3), 11, 3, 0);
+	fmt_str(p, " Wh");
+	LCDprint(lcd1, 1, 1);
+	LCDprint(lcd2, 2, 1);
+}
+
+/*
+ * The captured scan of all five inputs through multi.c, then the report:
+ *
+ * Line 1: " 60.00Hz R 0.54V"   reference (CH2) frequency and RMS
+ * Line 2: "  +30 -120 +120"    CH1, CH3, CH4 phase against CH2
+ */
+void Multi_Report (bit captured, gz_coef *c, unsigned long period_ticks, unsigned char cycles)
+{
+	unsigned char k;
+	char *p;
+	char lcd1[17];
+	char lcd2[17];
+	multi_chan *ch;
+
+	if (!captured)
+	{
+		LCDprint("MULTI: freq", 1, 1);
+		LCDprint("3Hz-500Hz only", 2, 1);
+		return;
+	}
+
+	multi_analyze(&multi, c, period_ticks, cycles);
+
+	fmt_puts("\x1b[H");
+	fmt_puts("Multi-channel, phase against CH2 (P2.2)\n\n");
+	fmt_puts("  CH  pin       V_RMS     Frequency       Phase\n");
+	for (k = 0; k < SCAN_MAX; k++)
+	{
+		ch = &multi.ch[k];
+		p = fmt_uint(lcd1, k + 1, 4);
+		p = fmt_str(p, "  P2.");
+		p[0] = '1' + k;
+		p[1] = 0;
+		fmt_puts(lcd1);
+		if (!ch->ok)
+		{
+			fmt_puts("  No signal                             \n");
+			continue;
+		}
+		Report_Field("  ", ch->vrms, 8, 4, 0, " V");
+		Report_Field("  ", ch->f, 9, 3, 0, " Hz");
+		if (k == MULTI_REF) fmt_puts("         ref  \n");
+		else if (multi.ch[MULTI_REF].ok) Report_Field("  ", ch->phase, 8, 2, FMT_PLUS, " deg\n");
+		else fmt_puts("         ---  \n");
+	}
+	fmt_puts("\x1b[J");
+
+	ch = &multi.ch[MULTI_REF];
+	if (ch->ok)
+	{
+		p = fmt_fix(lcd1, fmt_scale(ch->f, 2), 6, 2, 0);
+		p = fmt_str(p, "Hz R");
+		p = fmt_fix(p, fmt_scale(ch->vrms, 2), 5, 2, 0);
+		fmt_str(p, "V");
+	}
+	else fmt_str(lcd1, "Ref: No signal");
+	p = lcd2;
+	for (k = 0; k < 4; k++)
+	{
+		if (k == MULTI_REF) continue;
+		ch = &multi.ch[k];
+		if (ch->ok && multi.ch[MULTI_REF].ok) p = fmt_fix(p, fmt_scale(ch->phase, 0), 5, 0, FMT_PLUS);
+		else p = fmt_str(p, "  ---");
+	}
+	LCDprint(lcd1, 1, 1);
+	LCDprint(lcd2, 2, 1);
+}
+
+// A value of pq.c in volts, "---" if it is missing (flagged, not yet
+// filled in, no reference)
+void Pq_Volts_Field (char *label, unsigned int rms, bit ok)
+{
+	fmt_puts(label);
+	if (ok && rms != PQ_FLAGGED) Report_Field("", pq_volts(rms), 5, 3, 0, "");
+	else fmt_puts("  ---");
 }
 
-unsigned int ADC_at_Pin (unsigned char pin)
+/*
+ * The event log of pq.c, newest first, and the RMS(1/2) snapshot of the
+ * newest event:
+ *
+ * Line 1: "Ev   3 CH1 dip"    events since 'x', the newest one's input and type
+ * Line 2: "  52%    1.5 cyc"  its extreme (percent of the reference), duration
+ */
+void Events_Report (void)
 {
-	ADC0MX = pin;
-	ADINT  = 0;
-	ADBUSY = 1;
-	while (!ADINT);
-	return (ADC0);
+	unsigned char i, j, k;
+	char *p;
+	char lcd1[17];
+	char lcd2[17];
+
+	pq_get_status(&pq_st);
+	fmt_puts("\x1b[H");
+	fmt_puts(pq_st.running ? "Power-quality events, RMS(1/2) of CH1 and CH2              \n\n" :
+	                         "Power-quality events: stopped, the input is not 40-70 Hz    \n\n");
+	Report_Field("  Limits:  dip", pq_st.dip, 4, 0, 0, " %   swell");
+	Report_Field("", pq_st.swell, 4, 0, 0, " %   interruption");
+	Report_Field("", pq_st.interruption, 4, 0, 0, " %\n");
+	for (k = 0; k < 2; k++)
+	{
+		Pq_Volts_Field(k ? "  CH2:  RMS(1/2) " : "  CH1:  RMS(1/2) ", pq_st.rms[k], pq_st.running);
+		Pq_Volts_Field(" V   reference ", pq_st.ref[k], pq_st.ref[k] != 0);
+		fmt_puts(" V\n");
+	}
+	Report_Field("  Half-cycles:", pq_st.halves, 9, 0, 0, "   flagged:");
+	Report_Field("", pq_st.flagged, 8, 0, 0, "   events:");
+	Report_Field("", pq_st.count, 5, 0, 0, "\n\n");
+
+	fmt_puts("    time (s)   CH  type            extreme     cycles\n");
+	for (i = 0; pq_get_event(i, &pq_ev); i++)
+	{
+		fmt_fix(lcd1, (long)pq_ev.t_ms, 12, 3, 0);
+		fmt_puts(lcd1);
+		fmt_puts(pq_ev.chan ? "    2  " : "    1  ");
+		fmt_puts(pq_ev.type == PQ_DIP_EV   ? "dip         " :
+		         pq_ev.type == PQ_SWELL_EV ? "swell       " : "interruption");
+		Report_Field("", 100.0 * pq_ev.extreme / pq_ev.ref, 8, 1, 0, " %");
+		Report_Field("", pq_ev.halves * 0.5, 11, 1, 0, pq_ev.open ? " open\n" : "     \n");
+	}
+
+	// The snapshot, the first half-cycle past the limit after the '|'
+	if (pq_get_event(0, &pq_ev))
+	{
+		fmt_puts("\nNewest event, RMS(1/2) in V:\n");
+		for (k = 0; k < 2; k++)
+		{
+			fmt_puts(k ? "  CH2" : "  CH1");
+			for (j = 0; j < PQ_SNAP; j++)
+				Pq_Volts_Field(j == PQ_PRE ? "|" : " ", pq_ev.snap[j][k], j < pq_ev.fill);
+			fmt_puts("\n");
+		}
+	}
+	fmt_puts("\x1b[J");
+
+	if (!pq_st.running)
+	{
+		LCDprint("PQ: 40-70Hz only", 1, 1);
+		LCDprint("", 2, 1);
+		return;
+	}
+	if (!pq_get_event(0, &pq_ev))
+	{
+		LCDprint("Events: none", 1, 1);
+		LCDprint("", 2, 1);
+		return;
+	}
+	p = fmt_str(lcd1, "Ev");
+	p = fmt_uint(p, pq_st.count, 4);
+	p = fmt_str(p, pq_ev.chan ? " CH2" : " CH1");
+	fmt_str(p, pq_ev.type == PQ_DIP_EV ? " dip" : pq_ev.type == PQ_SWELL_EV ? " swl" : " int");
+	p = fmt_fix(lcd2, fmt_scale(100.0 * pq_ev.extreme / pq_ev.ref, 0), 4, 0, 0);
+	p = fmt_str(p, "%");
+	p = fmt_fix(p, fmt_scale(pq_ev.halves * 0.5, 1), 7, 1, 0);
+	fmt_str(p, " cyc");
+	LCDprint(lcd1, 1, 1);
+	LCDprint(lcd2, 2, 1);
 }
 
-float Volts_at_Pin (unsigned char pin)
+/*
+ * Once per reading in bargraph mode; Bar_Frame() draws line 1.
+ *
+ * Line 2: "1: 1.51V  60.0Hz"   the bar's input, V_RMS and frequency
+ *     or: "Ph +30.0d   60Hz"   Goertzel phase and frequency
+ */
+void Bar_Report (meas_result *m, float phase_gz)
 {
-	return ((ADC_at_Pin(pin) * VDD) / 0b_0011_1111_1111_1111);
+	char *p;
+	char lcd2[17];
+	float t = (float)(Ticks() - bar_ticks) * ((float)12 / SYSCLK);
+
+	bar_v[0] = (m->status & MEAS_CH1) ? m->v1max / 1.41421356237 : 0;
+	bar_v[1] = (m->status & MEAS_CH2) ? m->v2max / 1.41421356237 : 0;
+	bar_phase = (m->status == (MEAS_CH1 | MEAS_CH2)) ? phase_gz : 0;
+
+	fmt_puts("\x1b[H");
+	fmt_puts(bar_src == BAR_PHASE ? "Bargraph: phase, -180 .. +180 deg   \n" :
+	         bar_src == BAR_CH2   ? "Bargraph: CH2 V_RMS                 \n" :
+	                                "Bargraph: CH1 V_RMS                 \n");
+	fmt_puts("('b' again for CH1 / CH2 / phase)\n\n");
+	Report_Field("  LCD frames/s:    ", t > 0 ? bar_frames / t : 0, 7, 1, 0, "   \n");
+	Report_Field("  cells per frame: ", bar_frames ? (float)bar_writes / bar_frames : 0, 7, 2, 0, "   \n");
+	fmt_puts("\x1b[J");
+	bar_frames = bar_writes = 0;
+	bar_ticks = Ticks();
+
+	if (bar_src == BAR_PHASE)
+	{
+		p = fmt_str(lcd2, "Ph");
+		p = fmt_fix(p, fmt_scale(bar_phase, 1), 6, 1, FMT_PLUS);
+		p = fmt_str(p, "d");
+		p = fmt_fix(p, fmt_scale(m->f0, 0), 5, 0, 0);
+	}
+	else
+	{
+		p = fmt_str(lcd2, bar_src == BAR_CH2 ? "2:" : "1:");
+		p = fmt_fix(p, fmt_scale(bar_v[bar_src], 2), 5, 2, 0);
+		p = fmt_str(p, "V");
+		p = fmt_fix(p, fmt_scale(m->f0, 1), 6, 1, 0);
+	}
+	fmt_str(p, "Hz");
+	LCDprint(lcd2, 2, 1);
 }
 
 
@@ -271,36 +809,79 @@ float Volts_at_Pin (unsigned char pin)
  *   Normalize:  if phase > 180  -> phase -= 360  (CH1 lags CH2)
  *               if phase < -180 -> phase += 360
  *
- * MEASUREMENT SEQUENCE each loop:
+ * MEASUREMENT SEQUENCE each loop (steps 1-5 are Measure_Phase() in
+ * measure.c):
  *   1. Wait for both signals in valley (synchronized start)
- *   2. CH1 hump  -> collect v1max
- *   3. CH1 valley -> Timer0 -> T0 = 2 * valley_time
- *   4. CH1 rises again -> START Timer2 (phase timer)
- *   5. CH2 rises       -> STOP  Timer2 -> delta_t -> phase
- *   6. Ride CH2 hump   -> collect v2max
+ *   2. CH1 rises -> Timer0, ride the hump -> collect v1max,
+ *      CH1 rises again -> T0 = Timer0
+ *   3. At that same edge -> START Timer2 (phase timer)
+ *   4. CH2 rises       -> STOP  Timer2 -> delta_t -> phase
+ *   5. Ride CH2 hump   -> collect v2max
+ *   6. Capture GZ_CYCLES whole periods of CH1/CH2 -> energy, then
+ *      Goertzel amplitude and phase (averaged over GZ_AVG blocks)
+ *      or the harmonics / power screens
  *   (T1 = T0 since both channels are the same frequency)
+ *   Edge thresholds track each channel's span (midline +/- THR_HYST),
+ *   so the amplitude of either input does not need to be known.
+ *   Every wait has a deadline of ~1.5 periods; a channel that misses it
+ *   is shown as "No signal" while the other one is still measured.
+ *   Until it is back there are no blocks and no pauses: the loop goes
+ *   straight back to the edges, so the first edge of the returning
+ *   signal is timed, and the screen is redrawn every NOSIG_WAIT ms.
+ *   With 'e' steps 1-5 run in hardware instead (Measure_Window()): the
+ *   ADC window comparator interrupts at each crossing while the loop
+ *   does step 6 and the reports, and the peaks come from the blocks.
+ *   With 'k' step 6 samples with the period the blocks themselves
+ *   lock to instead of the reading's, and the frequency shown is that
+ *   period's.
+ *   With 'm' step 6 scans all five inputs in every slot of the block,
+ *   so the extra channels cost no edge waits of their own (multi.c).
+ *   Reports follow back to back (at least MULTI_GAP apart): a
+ *   refresh is about 7 periods of reading and block plus the math,
+ *   within 1 s from 10 Hz up.  Below that the block is MULTI_SLOW_CYCLES
+ *   periods timed by the one before, with no reading: about 2 periods,
+ *   within 1 s from 3 Hz.
+ *   With 's' the reports give way to triggered blocks of raw samples
+ *   streamed to the PC (scope.c), SCOPE_BURST per reading.
+ *   Whatever the screen, Timer4_ISR() in pq.c follows the RMS
+ *   of CH1 and CH2 every half-cycle, timed by the readings' period,
+ *   and logs dips, swells and interruptions; 'v' shows the log.
+ *   With 'b' line 1 of the LCD is a bar redrawn BAR_FRAMES times
+ *   between readings, only the cells that changed, from pq.c's RMS(1/2)
+ *   or its phase; line 2 keeps the reading's numbers.
  *
  **********************************************************************/
 
 void main (void)
 {
-	float v1, v2;
-	float v1max, v2max;
+	meas_result m;
 	float v1rms, v2rms;
-	float T0, f0;
-	float delta_t, phase;
-	unsigned int  tmr2_val;
-	unsigned char overflow2;
-	unsigned long dt_ticks;
+	unsigned long last_period, period, block, next_period;
+	unsigned int  skew;
+	unsigned char frame;
+	bit captured, whole, was_whole, slow;
+	float v1gz, v2gz, phase_gz;
+	gz_coef gzc, gzc_slow;
+	gz_avg  gza;
+	char *p;
 	char lcd1[17];
 	char lcd2[17];
 
 	waitms(500);
-	printf("\x1b[2J");
-	printf("Lab 5: AC Peak and Phase\n"
-	       "File: %s\n"
-	       "Compiled: %s, %s\n\n",
-	       __FILE__, __DATE__, __TIME__);
+	serial_init(SERIAL_DROP); // Reports are queued; the loop never waits on the PC
+	fmt_puts("\x1b[2J");
+	fmt_puts("Lab 5: AC Peak and Phase\n"
+	         "File: " __FILE__ "\n"
+	         "Compiled: " __DATE__ ", " __TIME__ "\n"
+	         "Keys: p = phase, h = harmonics, w = power, z = zero energy,\n"
+	         "      e = edges by polling / ADC window comparator,\n"
+	         "      r = edge ADC resolution, a = amplitude ADC averaging,\n"
+	         "      s = scope frames (settings in scope.c), m = P2.1-P2.5 multi-channel,\n"
+	         "      k = blocks locked to the input frequency,\n"
+	         "      o = full serial queue drops the newest / oldest text,\n"
+	         "      v = power-quality events (<%>d, <%>u, <%>n set the dip, swell and\n"
+	         "          interruption limits, x clears the log),\n"
+	         "      b = LCD bargraph (again: CH1 / CH2 / phase)\n\n");
 
 	InitPinADC(2, 1);
 	InitPinADC(2, 2);
@@ -309,6 +890,20 @@ void main (void)
 	InitPinADC(2, 5);
 	InitADC();
 
+	gz_setup(&gzc, GZ_CYCLES, GZ_N);
+	gz_setup(&gzc_slow, MULTI_SLOW_CYCLES, GZ_N);
+	gz_avg_reset(&gza);
+	harm_setup();
+	Scope_Reset();
+	Lock_Reset();
+	pq_start();
+	pwr_energy_reset(&energy);
+	energy_valid = 0;
+	last_period = 0;
+	next_period = 0;
+	was_whole = 1;
+	v1gz = v2gz = phase_gz = 0;
+
 	LCD_4BIT();
 	LCDprint("Lab5: AC Signal", 1, 1);
 	LCDprint("Initializing...", 2, 1);
@@ -317,132 +912,197 @@ void main (void)
 	while (1)
 	{
 		/***************************************************************
-		 * STEP 1: Synchronize — wait for both signals in their valleys
+		 * STEPS 1-5: Peaks, period and threshold phase
 		 ***************************************************************/
-		while (Volts_at_Pin(CH1) > THRESH1 || Volts_at_Pin(CH2) > THRESH2);
-
-		/***************************************************************
-		 * STEP 2: Collect CH1 peak during its hump
-		 ***************************************************************/
-		v1max = 0;
-
-		v1 = Volts_at_Pin(CH1);
-		while (v1 < THRESH1)
-			v1 = Volts_at_Pin(CH1);        // wait for CH1 rising edge
-
-		while (v1 > THRESH1)               // ride the hump
+		if (next_period)
 		{
-			if (v1 > v1max) v1max = v1;
-			v1 = Volts_at_Pin(CH1);
+			// A slow input on the multi screen: the period of the last
+			// block, the status of the last reading
+			m.period_ticks = next_period;
+			next_period = 0;
 		}
+		else if (edge_window) Measure_Window(&m);
+		else Measure_Phase(&m);
 
-		/***************************************************************
-		 * STEP 3: Time the CH1 valley -> get T0
-		 *
-		 * The valley is the flat 0V half-period, immune to sine-arch
-		 * clipping. T0 = 2 * valley_time.
-		 * ET0 disabled so ISR can't reset TMR0 mid-measurement.
-		 ***************************************************************/
-		ET0 = 0;
-		TR0 = 0; TMR0 = 0; TR0 = 1;
-
-		v1 = Volts_at_Pin(CH1);
-		while (v1 < THRESH1)               // wait for CH1 next rising edge
-			v1 = Volts_at_Pin(CH1);
-
-		TR0 = 0;
-		// CH1 just rose — this exact moment is the start of the phase measurement
+		// The event detector's half-cycles follow the period
+		if (m.status) pq_period(m.period_ticks);
 
-		T0 = 2.0 * (float)TMR0 * ((float)12 / SYSCLK);
-		f0 = 1.0 / T0;
+		// RMS values
+		v1rms = m.v1max / 1.41421356237;
+		v2rms = m.v2max / 1.41421356237;
 
 		/***************************************************************
-		 * STEP 4 & 5: Measure phase
-		 *
-		 * Timer2 starts NOW at CH1's rising edge.
-		 * We wait for CH2 to rise and stop Timer2.
-		 * delta_t = time from CH1 rise to CH2 rise.
-		 *
-		 * Overflow counter handles cases where CH2 lags CH1 by more
-		 * than ~10.9ms (Timer2's 16-bit limit at 6MHz).
-		 *
-		 * Sign convention:
-		 *   delta_t small  -> CH1 leads CH2 -> phase POSITIVE
-		 *   delta_t large  -> CH1 lags  CH2 -> phase NEGATIVE
-		 *                     (detected by normalizing > 180 -> -= 360)
+		 * STEP 6: Block capture, energy and the other display modes
 		 ***************************************************************/
-		TMR2H = 0;
-		TMR2L = 0;
-		TF2H  = 0;
-		overflow2 = 0;
-		TR2 = 1;  // START phase timer at CH1 rising edge
-
-		// If CH1 lags CH2, CH2 is already mid-hump when CH1 rises.
-		// Wait for CH2 current hump to END first, then catch the next
-		// rising edge. This gives the correct negative delta_t.
-		// If CH1 leads CH2, CH2 is still in valley so the first loop
-		// exits immediately — no extra delay, works correctly either way.
-		v2 = Volts_at_Pin(CH2);
-		while (v2 > THRESH2)               // skip current hump if mid-hump
+		// Blocks need both channels, but for the multi-channel scan,
+		// which only needs the period, and takes MULTI_SLOW_CYCLES
+		// periods a block of a slow input (multi.h)
+		whole = (m.status == (MEAS_CH1 | MEAS_CH2));
+		period = m.period_ticks;
+		slow = (meter_mode == MODE_MULTI && multi_slow(period));
+		if (freq_lock && m.status && !slow) period = Lock_Period(m.period_ticks);
+		block = slow ? period / (GZ_CYCLES / MULTI_SLOW_CYCLES) : period;
+		captured = ((whole || meter_mode == MODE_MULTI) && m.status && Block_Fits(block));
+		if (captured)
 		{
-			if (TF2H) { TF2H = 0; overflow2++; }
-			v2 = Volts_at_Pin(CH2);
+			skew = Capture_Block(block);
+			if (freq_lock && !slow)
+			{
+				// The locked period is finer than the edge-timed one
+				m.T0 = Lock_Update((m.status & MEAS_CH1) ? gz_buf1 : gz_buf2, period) *
+				       ((float)12 / SYSCLK);
+				m.f0 = 1.0 / m.T0;
+			}
 		}
-		while (v2 < THRESH2)               // wait for next rising edge
+		// The window run times the next reading's edges while this one
+		// is analysed and reported; it needs the thresholds the block
+		// just updated.  A slow multi block is followed by no reading,
+		// and power and energy need blocks of GZ_CYCLES periods.
+		if (edge_window && captured && whole && !slow) Window_Start();
+		Update_Energy(captured && whole && !slow);
+
+		Check_Mode_Key();
+		if (!whole && meter_mode != MODE_MULTI && meter_mode != MODE_SCOPE)
 		{
-			if (TF2H) { TF2H = 0; overflow2++; }
-			v2 = Volts_at_Pin(CH2);
+			// Every NOSIG_WAIT ms, the first reading without it at once
+			if (!was_whole && Ticks() - nosig_ticks < NOSIG_WAIT * TB_TICKS_PER_MS)
+				continue;
+			nosig_ticks = Ticks();
+		}
+		was_whole = whole;
+		if (meter_mode == MODE_HARMONICS)
+		{
+			Harmonics_Report(m.status, captured, m.f0);
+			if (whole) waitms(HARM_WAIT);
+			continue;
+		}
+		if (meter_mode == MODE_POWER)
+		{
+			Power_Report(m.status, captured, m.f0);
+			if (whole) waitms(PWR_WAIT);
+			continue;
+		}
+		if (meter_mode == MODE_MULTI)
+		{
+			// Back to back, unless the serial report would fall behind
+			while (Ticks() - multi_ticks < MULTI_GAP * TB_TICKS_PER_MS);
+			multi_ticks = Ticks();
+			Multi_Report(captured, slow ? &gzc_slow : &gzc, period,
+			             slow ? MULTI_SLOW_CYCLES : GZ_CYCLES);
+			if (captured && slow) next_period = multi_next(&multi);
+			continue;
+		}
+		if (meter_mode == MODE_EVENTS)
+		{
+			Events_Report();
+			if (whole) waitms(EVENTS_WAIT);
+			continue;
+		}
+		if (meter_mode == MODE_SCOPE)
+		{
+			// Triggered blocks back to back; the reading above only keeps
+			// the automatic interval and trigger level following the input
+			if (edge_window) Window_Stop();
+			for (frame = 0; frame < SCOPE_BURST && meter_mode == MODE_SCOPE; frame++)
+			{
+				Scope_Frame(m.status ? m.period_ticks : 0);
+				Check_Mode_Key();
+			}
+			continue;
 		}
-		TR2 = 0;  // STOP at CH2 rising edge
-
-		tmr2_val = ((unsigned int)TMR2H << 8) | (unsigned int)TMR2L;
-		dt_ticks = (unsigned long)overflow2 * 65536UL + (unsigned long)tmr2_val;
-		delta_t  = (float)dt_ticks * ((float)12 / SYSCLK);
-
-		phase = (delta_t / T0) * 360.0;
-
-		// Normalize to -180 to +180
-		// > 180 means CH1 appears to "lead" by a lot but actually lags
-		if (phase > 180.0)  phase -= 360.0;
-		if (phase < -180.0) phase += 360.0;
 
 		/***************************************************************
-		 * STEP 6: Collect CH2 peak
+		 * Goertzel amplitude and phase
 		 *
-		 * We're sitting right at CH2's rising edge from step 5.
-		 * Just ride the hump to get v2max — no extra sync needed.
+		 * One bin at the fundamental (k = GZ_CYCLES) per channel over
+		 * a block of whole cycles. The block mean is removed, so DC
+		 * offset and the threshold settings do not bias the result,
+		 * and noise averages down over GZ_N samples and GZ_AVG blocks.
+		 * CH2 is converted 'skew' ticks after CH1 in every pair, which
+		 * would read as CH1 lagging: add it back.
+		 * A period jump of more than 1/16, or losing either channel,
+		 * restarts the average.
 		 ***************************************************************/
-		v2max = 0;
-		v2 = Volts_at_Pin(CH2);
-		while (v2 > THRESH2)
+		if (m.status != (MEAS_CH1 | MEAS_CH2))
 		{
-			if (v2 > v2max) v2max = v2;
-			v2 = Volts_at_Pin(CH2);
+			gz_avg_reset(&gza);
+			last_period = 0;
 		}
+		else if (captured)
+		{
+			if (labs((long)(period - last_period)) > (long)(last_period >> 4))
+				gz_avg_reset(&gza);
+			last_period = period;
 
-		// RMS values
-		v1rms = v1max / 1.41421356237;
-		v2rms = v2max / 1.41421356237;
+			gz_avg_add(&gza, &gzc, gz_buf1, gz_buf2, GZ_N);
+
+			v1gz = GZ_PEAK_SCALE * gz_peak(gza.p1, GZ_N) * VDD / 0b_0011_1111_1111_1111;
+			v2gz = GZ_PEAK_SCALE * gz_peak(gza.p2, GZ_N) * VDD / 0b_0011_1111_1111_1111;
+			phase_gz = gz_phase(&gza) + (360.0 * skew) / period;
+			if (phase_gz > 180.0)  phase_gz -= 360.0;
+			if (phase_gz < -180.0) phase_gz += 360.0;
+		}
+
+		if (meter_mode == MODE_BAR)
+		{
+			Bar_Report(&m, phase_gz);
+			for (frame = 0; whole && frame < BAR_FRAMES && meter_mode == MODE_BAR; frame++)
+			{
+				Bar_Frame();
+				waitms(BAR_FRAME_MS);
+				Check_Mode_Key();
+			}
+			continue;
+		}
 
 		/***************************************************************
 		 * SERIAL OUTPUT (PuTTY)
 		 ***************************************************************/
-		printf("\x1b[H");
-		printf("CH1 (measured):\n");
-		printf("  Period:    %7.5f s       \n", T0);
-		printf("  Frequency: %7.3f Hz      \n", f0);
-		printf("  V_PEAK:    %7.4f V       \n", v1max);
-		printf("  V_RMS:     %7.4f V       \n", v1rms);
-		printf("  Phase:     %+7.2f deg    \n\n", phase);
-		printf("CH2 (reference):\n");
-		printf("  Frequency: %7.3f Hz      \n", f0);
-		printf("  V_PEAK:    %7.4f V       \n", v2max);
-		printf("  V_RMS:     %7.4f V       \n", v2rms);
-		printf("  Phase:      0.00 deg (ref)\n");
+		fmt_puts("\x1b[H");
+		fmt_puts("CH1 (measured):\n");
+		if (m.status & MEAS_CH1)
+		{
+			Report_Field("  Period:    ", m.T0, 7, 5, 0, " s       \n");
+			Report_Field("  Frequency: ", m.f0, 7, 3, 0, " Hz      \n");
+			Report_Field("  V_PEAK:    ", m.v1max, 7, 4, 0, " V       \n");
+			Report_Field("  V_RMS:     ", v1rms, 7, 4, 0, " V       \n");
+		}
+		else fmt_puts("  No signal\n");
+		if (m.status == (MEAS_CH1 | MEAS_CH2))
+		{
+			Report_Field("  Phase:     ", m.phase, 7, 2, FMT_PLUS, " deg    \n");
+			Report_Field("  V_PEAK/DFT:", v1gz, 7, 4, 0, " V       \n");
+			Report_Field("  Phase/DFT: ", phase_gz, 7, 2, FMT_PLUS, " deg    \n");
+		}
+		fmt_puts("\nCH2 (reference):\n");
+		if (m.status & MEAS_CH2)
+		{
+			Report_Field("  Frequency: ", m.f0, 7, 3, 0, " Hz      \n");
+			Report_Field("  V_PEAK:    ", m.v2max, 7, 4, 0, " V       \n");
+			Report_Field("  V_RMS:     ", v2rms, 7, 4, 0, " V       \n");
+			if (m.status & MEAS_CH1)
+				Report_Field("  V_PEAK/DFT:", v2gz, 7, 4, 0, " V       \n");
+			fmt_puts("  Phase:      0.00 deg (ref)\n");
+		}
+		else fmt_puts("  No signal\n");
+		fmt_puts(edge_window ? "\nEdges: ADC window, " : "\nEdges: polled, ");
+		fmt_puts(Profile_Name(meas_edge));
+		fmt_puts("   Amplitude: ");
+		fmt_puts(Profile_Name(meas_block));
+		fmt_puts(freq_lock ? "\nBlocks: locked to the input   \n" : "\nBlocks: edge-timed period   \n");
+		pq_get_status(&pq_st);
+		Report_Field("Power-quality events: ", pq_st.count, 0, 0, 0, " ('v')   \n");
+		// Characters a full queue lost, which can leave a line or an
+		// escape sequence short until the next report
+		Report_Field("Serial characters lost: ", serial_dropped(), 0, 0, 0,
+		             tx_overwrite ? " (oldest text lost, 'o')   \n" : " (newest text lost, 'o')   \n");
+		fmt_puts("\x1b[J"); // Clear what a longer screen left below
 
 		/***************************************************************
 		 * LCD OUTPUT (16 chars per line, no CH1/CH2 labels)
 		 *
+		 * Built with fixfmt.c; the widths below are its field widths.
+		 *
 		 * Line 1 (CH1): "60.0Hz 1.51V+30d"
 		 *                 freq   Vrms  phase
 		 * Line 2 (CH2): "60.0Hz 0.75V ref"
@@ -453,12 +1113,33 @@ void main (void)
 		 *  %5.2fV   = 6 chars  (e.g. " 1.51V")
 		 *  %+4.0fd  = 4 chars  (e.g. "+30d" or "-15d") for line 1
 		 *  " ref"   = 4 chars                           for line 2
+		 *
+		 * The LCD shows the Goertzel phase; the threshold phase stays
+		 * on the serial report for comparison. A missing channel
+		 * shows "No signal" and the phase field " ---".
 		 ***************************************************************/
-		sprintf(lcd1, "%4.0fHz%5.2fV%+4.0f", f0, v1rms, phase);
-		sprintf(lcd2, "%4.0fHz%5.2fV ref",     f0, v2rms);
+		if (m.status & MEAS_CH1)
+		{
+			p = fmt_fix(lcd1, fmt_scale(m.f0, 0), 4, 0, 0);
+			p = fmt_str(p, "Hz");
+			p = fmt_fix(p, fmt_scale(v1rms, 2), 5, 2, 0);
+			p = fmt_str(p, "V");
+			if (m.status & MEAS_CH2) fmt_fix(p, fmt_scale(phase_gz, 0), 4, 0, FMT_PLUS);
+			else fmt_str(p, " ---");
+		}
+		else fmt_str(lcd1, "CH1 No signal");
+
+		if (m.status & MEAS_CH2)
+		{
+			p = fmt_fix(lcd2, fmt_scale(m.f0, 0), 4, 0, 0);
+			p = fmt_str(p, "Hz");
+			p = fmt_fix(p, fmt_scale(v2rms, 2), 5, 2, 0);
+			fmt_str(p, "V ref");
+		}
+		else fmt_str(lcd2, "CH2 No signal");
 		LCDprint(lcd1, 1, 1);
 		LCDprint(lcd2, 2, 1);
 
-		waitms(500);
+		if (whole) waitms(500);
 	}
 }
@@ -0,0 +1,71 @@
+// fixfmt.c:  Fixed-point decimal formatting for the LCD and serial report
+//
+// Every function writes at 'p', NUL terminates and returns a pointer to the
+// terminator, so a line is built by chaining calls into one buffer.
+
+#include <stdio.h>
+#include "fixfmt.h"
+
+code long fmt_pow10[FMT_MAXDP+1] = { 1L, 10L, 100L, 1000L, 10000L, 100000L, 1000000L };
+
+// v / 10^dp, at least one digit before the point, right aligned in 'width'
+char *fmt_fix (char *p, long v, unsigned char width, unsigned char dp, unsigned char flags)
+{
+	char tmp[14];
+	unsigned char n = 0, digits = 0;
+	unsigned long u;
+	unsigned int w;
+
+	u = (v < 0) ? -v : v;
+	do
+	{
+		if (dp && digits == dp) tmp[n++] = '.';
+		if (u > 0xFFFFUL)
+		{
+			tmp[n++] = '0' + (unsigned char)(u % 10);
+			u /= 10;
+		}
+		else
+		{
+			// 16-bit divide once the value fits: much cheaper on the 8051
+			w = (unsigned int)u;
+			tmp[n++] = '0' + (unsigned char)(w % 10);
+			u = w / 10;
+		}
+		digits++;
+	} while (u || digits <= dp);
+
+	if (v < 0) tmp[n++] = '-';
+	else if (flags & FMT_PLUS) tmp[n++] = '+';
+
+	while (width > n) { *p++ = ' '; width--; }
+	while (n) *p++ = tmp[--n];
+	*p = 0;
+	return p;
+}
+
+char *fmt_uint (char *p, unsigned int v, unsigned char width)
+{
+	return fmt_fix(p, v, width, 0, 0);
+}
+
+char *fmt_str (char *p, char *s)
+{
+	while (*s) *p++ = *s++;
+	*p = 0;
+	return p;
+}
+
+// Round x * 10^dp to the nearest long, halves away from zero
+long fmt_scale (float x, unsigned char dp)
+{
+	x *= fmt_pow10[dp];
+	if (x >= 2.0e9) return 2000000000L;
+	if (x <= -2.0e9) return -2000000000L;
+	return (x < 0) ? -(long)(0.5 - x) : (long)(x + 0.5);
+}
+
+void fmt_puts (char *s)
+{
+	while (*s) putchar(*s++);
+}
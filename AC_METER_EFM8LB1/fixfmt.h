@@ -0,0 +1,19 @@
+// fixfmt.h:  Fixed-point decimal formatting for the LCD and serial report
+//
+// A value is a long holding x * 10^dp.  fmt_fix() renders it right aligned
+// in a field of 'width' characters, like printf's "%<width>.<dp>f", without
+// pulling in the C51 float printf.
+
+#ifndef FIXFMT_H
+#define FIXFMT_H
+
+#define FMT_PLUS 0x01  // Print '+' on positive values, like "%+f"
+#define FMT_MAXDP 6
+
+char *fmt_fix (char *p, long v, unsigned char width, unsigned char dp, unsigned char flags);
+char *fmt_uint (char *p, unsigned int v, unsigned char width);
+char *fmt_str (char *p, char *s);
+long  fmt_scale (float x, unsigned char dp);
+void  fmt_puts (char *s);
+
+#endif
@@ -0,0 +1,94 @@
+// goertzel.c:  Fixed-point single-bin DFT (Goertzel) for the AC meter
+//
+// See goertzel.h for the block layout.  Sample buffers live in XRAM.
+
+#include <math.h>
+#include "goertzel.h"
+
+#define PI 3.14159265358979
+
+// Coefficients for bin k of an n-point block: w = 2*pi*k/n
+void gz_setup (gz_coef *c, unsigned int k, unsigned int n)
+{
+	float w = (2.0 * PI * k) / n;
+	c->cw = (int)floor(cos(w) * GZ_ONE + 0.5);
+	c->sw = (int)floor(sin(w) * GZ_ONE + 0.5);
+}
+
+// Block mean, rounded.  Removing it keeps the Goertzel state small.
+int gz_mean (xdata int *x, unsigned int n)
+{
+	unsigned int i;
+	long sum = 0;
+	for (i = 0; i < n; i++) sum += x[i];
+	return (int)((sum + (n >> 1)) / n);
+}
+
+// (a * s) >> GZ_QBITS without a 64-bit intermediate.  s is split into a
+// high part and a 14-bit low part so both partial products fit in a long
+// as long as |a| <= 2^15 and |s| < 2^30.
+static long gz_mulq (long a, long s)
+{
+	long hi = s >> GZ_QBITS;
+	long lo = s & (GZ_ONE - 1);
+	return (a * hi) + ((a * lo + (GZ_ONE >> 1)) >> GZ_QBITS);
+}
+
+// Goertzel recursion s[i] = x[i] + 2cos(w)*s[i-1] - s[i-2] over one block.
+// For a 14-bit input and n = 128 the state stays below 2^22.
+void gz_run (gz_bin *b, gz_coef *c, xdata int *x, unsigned int n, int mean)
+{
+	unsigned int i;
+	long c2 = (long)c->cw * 2;
+	long s0, s1 = 0, s2 = 0;
+
+	for (i = 0; i < n; i++)
+	{
+		s0 = (long)(x[i] - mean) + gz_mulq(c2, s1) - s2;
+		s2 = s1;
+		s1 = s0;
+	}
+	// y = s1 - e^(-jw)*s2 = X(w) * e^(jw(n-1)); the rotation is common to
+	// both channels so it cancels in the relative phase.
+	b->re = s1 - gz_mulq(c->cw, s2);
+	b->im = gz_mulq(c->sw, s2);
+}
+
+void gz_avg_reset (gz_avg *a)
+{
+	a->p1 = a->p2 = 0;
+	a->cr = a->ci = 0;
+	a->n = 0;
+}
+
+// Run the bin on one CH1/CH2 block and fold it into the running average.
+// The cross spectrum does not depend on where the block started, so blocks
+// that are not phase aligned with each other still average coherently.
+void gz_avg_add (gz_avg *a, gz_coef *c, xdata int *x1, xdata int *x2, unsigned int n)
+{
+	gz_bin b1, b2;
+	float r1, i1, r2, i2;
+
+	gz_run(&b1, c, x1, n, gz_mean(x1, n));
+	gz_run(&b2, c, x2, n, gz_mean(x2, n));
+	r1 = b1.re; i1 = b1.im;
+	r2 = b2.re; i2 = b2.im;
+
+	if (a->n < GZ_AVG) a->n++;
+	a->p1 += ((r1*r1 + i1*i1) - a->p1) / a->n;
+	a->p2 += ((r2*r2 + i2*i2) - a->p2) / a->n;
+	a->cr += ((r1*r2 + i1*i2) - a->cr) / a->n;
+	a->ci += ((i1*r2 - r1*i2) - a->ci) / a->n;
+}
+
+// Peak amplitude (ADC counts) of the sinusoid behind bin power p
+float gz_peak (float p, unsigned int n)
+{
+	return 2.0 * sqrt(p) / n;
+}
+
+// Phase of CH1 relative to CH2 in degrees, (+) when CH1 leads
+float gz_phase (gz_avg *a)
+{
+	return atan2(a->ci, a->cr) * (180.0 / PI);
+}
@@ -0,0 +1,48 @@
+// goertzel.h:  Fixed-point single-bin DFT (Goertzel) for the AC meter
+//
+// The capture loop in FULLY_WORKING.c paces CH1/CH2 sample pairs from the
+// measured period so that a block holds exactly GZ_CYCLES whole cycles of
+// GZ_SPC samples each.  Every bin of interest then sits on an integer k and
+// the large DC term of the half-wave rectified inputs does not leak into it.
+//
+// The per-sample work is fixed point (two 32-bit multiplies per sample);
+// only the once-per-block averaging and the final sqrt/atan2 use floats.
+
+#ifndef GOERTZEL_H
+#define GOERTZEL_H
+
+#define GZ_SPC    32                  // Samples per cycle of the fundamental
+#define GZ_CYCLES 4                   // Whole cycles captured per block
+#define GZ_N      (GZ_SPC*GZ_CYCLES)  // Samples per channel per block
+#define GZ_QBITS  14                  // Coefficients are Q2.14
+#define GZ_ONE    (1L<<GZ_QBITS)
+#define GZ_AVG    8                   // Blocks in the running average
+
+typedef struct
+{
+	int cw;  // cos(w) in Q2.14
+	int sw;  // sin(w) in Q2.14
+} gz_coef;
+
+typedef struct
+{
+	long re; // Goertzel output s1 - e^(-jw)*s2 (unnormalized DFT bin)
+	long im;
+} gz_bin;
+
+typedef struct
+{
+	float p1, p2;    // Averaged bin power of CH1 and CH2
+	float cr, ci;    // Averaged cross spectrum CH1 * conj(CH2)
+	unsigned char n; // Blocks in the average so far (saturates at GZ_AVG)
+} gz_avg;
+
+void  gz_setup (gz_coef *c, unsigned int k, unsigned int n);
+int   gz_mean (xdata int *x, unsigned int n);
+void  gz_run (gz_bin *b, gz_coef *c, xdata int *x, unsigned int n, int mean);
+void  gz_avg_reset (gz_avg *a);
+void  gz_avg_add (gz_avg *a, gz_coef *c, xdata int *x1, xdata int *x2, unsigned int n);
+float gz_peak (float p, unsigned int n);
+float gz_phase (gz_avg *a);
+
+#endif
@@ -0,0 +1,64 @@
+// harmonics.c:  Harmonic analysis and THD for the AC meter
+//
+// The cost is one gz_run() per harmonic per channel (roughly 1 ms each for
+// a 128-sample block at 72 MHz) plus a few floats per harmonic.
+
+#include <math.h>
+#include "goertzel.h"
+#include "harmonics.h"
+
+xdata gz_coef harm_coef[HARM_MAX+1];
+
+void harm_setup (void)
+{
+	unsigned char h;
+	for (h = 1; h <= HARM_MAX; h++)
+		gz_setup(&harm_coef[h], h * GZ_CYCLES, GZ_N);
+}
+
+// Harmonic magnitudes, THD and the largest harmonics of one block.
+//
+// With 'halfwave' set the block is taken to be a half-wave rectified
+// signal r(t) = max(s(t), 0), as on the AC meter inputs.  If s has no even
+// harmonics (s(t + T/2) = -s(t), the usual case for power distortion) then
+// s(t) = r(t) - r(t + T/2).  Over a whole number of cycles the half-period
+// shift multiplies bin h by (-1)^h, so the odd harmonics of s are exactly
+// twice those of r and the even bins carry nothing about s: they are
+// skipped and reported as zero.
+void harm_analyze (harm_result *r, xdata int *x, unsigned int n, bit halfwave)
+{
+	gz_bin b;
+	unsigned char h, i, j;
+	int mean = gz_mean(x, n);
+	float scale = halfwave ? 4.0 : 2.0;
+	float re, im, sum = 0;
+
+	r->mag[0] = 0;
+	for (h = 1; h <= HARM_MAX; h++)
+	{
+		if (halfwave && (h & 1) == 0)
+		{
+			r->mag[h] = 0;
+			continue;
+		}
+		gz_run(&b, &harm_coef[h], x, n, mean);
+		re = b.re;
+		im = b.im;
+		r->mag[h] = scale * sqrt(re*re + im*im) / n;
+		if (h > 1) sum += r->mag[h] * r->mag[h];
+	}
+
+	r->thd = (r->mag[1] > 0) ? 100.0 * sqrt(sum) / r->mag[1] : 0;
+
+	// Insertion of the largest harmonics into top[], descending (0 = none)
+	for (i = 0; i < HARM_TOP; i++) r->top[i] = 0;
+	for (h = 2; h <= HARM_MAX; h++)
+	{
+		if (r->mag[h] <= 0) continue;
+		for (i = 0; i < HARM_TOP; i++)
+			if (r->top[i] == 0 || r->mag[h] > r->mag[r->top[i]]) break;
+		if (i == HARM_TOP) continue;
+		for (j = HARM_TOP - 1; j > i; j--) r->top[j] = r->top[j-1];
+		r->top[i] = h;
+	}
+}
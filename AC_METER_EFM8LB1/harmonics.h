@@ -0,0 +1,25 @@
+// harmonics.h:  Harmonic analysis and THD for the AC meter
+//
+// A bank of Goertzel bins (goertzel.c) at harmonics 1..HARM_MAX of one
+// coherently captured block: GZ_CYCLES whole cycles of GZ_SPC samples, so
+// harmonic h sits exactly on bin k = h*GZ_CYCLES.  GZ_SPC = 32 puts the
+// Nyquist limit at the 16th harmonic.
+
+#ifndef HARMONICS_H
+#define HARMONICS_H
+
+#define HARM_MAX 15  // Highest harmonic analyzed
+#define HARM_TOP 3   // Largest harmonics reported
+
+typedef struct
+{
+	float mag[HARM_MAX+1];          // Peak ADC counts, [1] = fundamental (before the
+	                                // rectifier if analyzed as half-wave)
+	float thd;                      // Harmonics 2..HARM_MAX over fundamental, %
+	unsigned char top[HARM_TOP];    // Largest harmonics (2..HARM_MAX), descending
+} harm_result;
+
+void harm_setup (void);
+void harm_analyze (harm_result *r, xdata int *x, unsigned int n, bit halfwave);
+
+#endif
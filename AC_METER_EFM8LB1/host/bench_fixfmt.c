@@ -0,0 +1,97 @@
+// bench_fixfmt.c:  Host check of fixfmt.c against printf
+//
+// Renders the fields of the AC meter reports with both fixfmt and the C
+// library printf over random values and counts differences.  Values that
+// land within float rounding of a half step may legitimately differ in the
+// last digit (fmt_scale rounds the float, printf the exact binary value),
+// and printf keeps the sign of results that round to zero ("-0.00"):
+// those are counted separately from real mismatches.
+//
+// Host timings are only a sanity check; on the EFM8 the saving is measured
+// with FMT_BENCH in FULLY_WORKING.c.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "fixfmt.h"
+
+#define SAMPLES 1000000
+
+typedef struct
+{
+	const char *fmt;
+	unsigned char width, dp, flags;
+	float range;
+} field;
+
+// Every float field of the serial report and LCD lines
+static field fields[] =
+{
+	{ "%7.5f",  7, 5, 0,        1.0    },
+	{ "%7.3f",  7, 3, 0,        1000.0 },
+	{ "%7.4f",  7, 4, 0,        3.3    },
+	{ "%+7.2f", 7, 2, FMT_PLUS, 180.0  },
+	{ "%4.0f",  4, 0, 0,        1000.0 },
+	{ "%5.2f",  5, 2, 0,        3.3    },
+	{ "%+4.0f", 4, 0, FMT_PLUS, 180.0  },
+	{ "%10.4f", 10, 4, 0,       100.0  },
+};
+
+static unsigned long long rng = 0x9E3779B97F4A7C15ULL;
+
+static float frand (float range)
+{
+	rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+	return (float)(((rng >> 11) * (1.0 / 9007199254740992.0)) * 2.0 - 1.0) * range;
+}
+
+// Is x within float rounding of a half step in the last printed digit?
+static int near_half (float x, unsigned char dp)
+{
+	double s = x * pow(10.0, dp), f = fabs(s - floor(s)) - 0.5;
+	return fabs(f) < fabs(s) * 1.2e-7 + 1e-9;
+}
+
+int main (void)
+{
+	char a[32], b[32];
+	unsigned int f;
+	long i, bad, edge, negzero;
+	float x;
+	clock_t t0;
+	double t_printf, t_fmt;
+	volatile float sink = 0;
+
+	printf("%-8s %10s %10s %10s\n", "field", "mismatch", "half-step", "-0");
+	for (f = 0; f < sizeof(fields) / sizeof(fields[0]); f++)
+	{
+		bad = edge = negzero = 0;
+		for (i = 0; i < SAMPLES; i++)
+		{
+			x = frand(fields[f].range);
+			sprintf(a, fields[f].fmt, x);
+			fmt_fix(b, fmt_scale(x, fields[f].dp), fields[f].width, fields[f].dp, fields[f].flags);
+			if (strcmp(a, b) == 0) continue;
+			if (near_half(x, fields[f].dp)) edge++;
+			else if (strchr(a, '-') && fmt_scale(x, fields[f].dp) == 0) negzero++;
+			else
+			{
+				if (bad < 5) printf("  %s: printf \"%s\" fixfmt \"%s\"\n", fields[f].fmt, a, b);
+				bad++;
+			}
+		}
+		printf("%-8s %10ld %10ld %10ld\n", fields[f].fmt, bad, edge, negzero);
+	}
+
+	t0 = clock();
+	for (i = 0; i < SAMPLES; i++) { sprintf(a, "%7.4f", frand(3.3f)); sink += a[3]; }
+	t_printf = (double)(clock() - t0) / CLOCKS_PER_SEC;
+	t0 = clock();
+	for (i = 0; i < SAMPLES; i++) { fmt_fix(b, fmt_scale(frand(3.3f), 4), 7, 4, 0); sink += b[3]; }
+	t_fmt = (double)(clock() - t0) / CLOCKS_PER_SEC;
+	printf("\nhost %%7.4f: printf %.0f ns, fixfmt %.0f ns per field\n",
+	       t_printf * 1e9 / SAMPLES, t_fmt * 1e9 / SAMPLES);
+	return 0;
+}
@@ -0,0 +1,325 @@
+// bench_measure.c:  Accuracy sweep of the AC meter measurement core
+//
+// Runs measure.c unchanged against the simulated ADC and timers of sim.c.
+// CH2 is the reference at phase 0 and CH1 is offset by the swept phase, so
+// the expected reading is that phase (CH1 leading is positive).  For every
+// frequency the sweep covers -180..+180 degrees and reports:
+//
+//   T0 err    - period of the reading (CH1 rise to rise), worst case
+//   full err  - Measure_Full_Period() on CH2 (v_f_lcd.c / lab5_ver1.c)
+//   pk err    - v1max against the true CH1 peak, worst case
+//   thr rms/max - threshold phase of the reading
+//   gz rms/max  - Goertzel phase of FULLY_WORKING.c, averaged over the
+//                 readings of each point, skew corrected
+//   rd/s      - readings per simulated second (the reading plus
+//               Capture_Block(), no report or display time)
+//
+// Each row starts with WARMUP discarded readings, the time the deadline and
+// the threshold tracker in measure.c need to follow a new signal.
+// A reading that does not finish within HANG_S simulated seconds is
+// counted as a hang.  Errors are percent of the true value or degrees.
+//
+// The amplitude sweep repeats the 60 Hz row with both inputs scaled from
+// 1.5x down to 1/100 of the defaults (the adaptive thresholds must follow).
+//
+// The probe-off runs then disconnect CH1, CH2 or both at 60 Hz from
+// OFF_FROM to OFF_UNTIL and report the longest reading during the outage,
+// the readings in which the still-connected channel was lost, and, in
+// periods, when the first reading with both channels ends: after the
+// input returns, and after the first rising edge it shows (the first
+// instant an edge can be timed; up to a period after the return).  Each
+// is the worst of OFF_PHASES returns spread over a period, and the run
+// fails if the reading ends more than BACK_MAX periods after that edge.
+// Like FULLY_WORKING.c, blocks are only captured with both channels.
+//
+// With -w 1 the readings come from Measure_Window() like FULLY_WORKING.c
+// with 'e': each captured block arms the window run for the next reading.
+// -e and -p pick the ADC profiles (measure.h, ADC_AMPL = 0 ...) for the
+// edges and for peaks and blocks.  The simulated conversion time stays
+// -c whatever the profile.  With -k 1 the blocks are sampled with the
+// frequency lock of measure.c (FULLY_WORKING.c with 'k'), which carries
+// over from one phase point to the next of a row.
+//
+// Usage:  bench_measure [-n noise_V] [-o dc_V] [-3 h3] [-a ch1_peak_V]
+//                       [-b ch2_peak_V] [-c conv_us] [-w 0|1] [-k 0|1]
+//                       [-e edge_profile] [-p block_profile]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sim.h"
+#include "sim/EFM8LB1.h"
+#include "goertzel.h"
+#include "measure.h"
+
+#define READINGS 3      // Per phase point
+#define WARMUP   4      // Readings discarded when a row starts
+#define PH_STEP  15     // Degrees
+#define HANG_S   30.0   // Simulated seconds allowed per reading
+#define OFF_FROM  1.0   // Probe-off window, seconds
+#define OFF_UNTIL 2.5
+#define OFF_END   4.0
+#define OFF_PHASES 8    // Return instants per probe-off run
+#define BACK_MAX  1.05  // Periods from the first edge to a complete reading
+
+static double freqs[] = { 1, 2, 5, 10, 20, 45, 50, 60, 100, 200, 400, 700, 1000 };
+static double scales[] = { 1.5, 1.0, 0.3, 0.1, 0.03, 0.01 };
+static double conv = 5.0;
+static int window, lock;
+static unsigned int skew;
+static unsigned long block_period;  // Of the last block
+static double t_edges;              // sim_now() when the last reading's edges were done
+
+static double wrap (double d)
+{
+	while (d > 180.0)   d -= 360.0;
+	while (d <= -180.0) d += 360.0;
+	return d;
+}
+
+static double rel (double x, double truth)
+{
+	return fabs(x - truth) / truth * 100.0;
+}
+
+// One reading and its block capture; returns 1 if a block was captured
+static int reading (meas_result *m)
+{
+	if (window) Measure_Window(m);
+	else Measure_Phase(m);
+	t_edges = sim_now();
+	block_period = m->period_ticks;
+	if (lock && m->status) block_period = Lock_Period(m->period_ticks);
+	if (m->status != (MEAS_CH1 | MEAS_CH2) || !Block_Fits(block_period))
+		return 0;
+	skew = Capture_Block(block_period);
+	if (lock) Lock_Update(gz_buf1, block_period);
+	if (window) Window_Start();
+	return 1;
+}
+
+// Phase sweep at one frequency, one table row
+static void sweep_row (const char *label, double f, sim_wave w1, sim_wave w2)
+{
+	meas_result m;
+	gz_coef gzc;
+	gz_avg gza;
+	unsigned long full;
+	double ph, e, pk1;
+	int r;
+	float vmax, phase_gz;
+	// Static: updated between setjmp() and a possible longjmp()
+	static double t_meas, e_t0, e_full, e_pk, thr_ss, thr_max, gz_ss, gz_max;
+	static int n_thr, n_gz, hangs, readings;
+
+	gz_setup(&gzc, GZ_CYCLES, GZ_N);
+	e_t0 = e_full = e_pk = thr_ss = thr_max = gz_ss = gz_max = 0;
+	n_thr = n_gz = hangs = readings = 0;
+	t_meas = 0;
+
+	for (ph = -180; ph <= 180; ph += PH_STEP)
+	{
+		sim_reset((unsigned long)(f * 1000 + ph + 180));
+		sim_conv_us(conv);
+		Window_Stop();
+		w1.freq = w2.freq = f;
+		w1.phase = ph;
+		w2.phase = 0;
+		sim_set_wave(CH1, &w1);
+		sim_set_wave(CH2, &w2);
+		pk1 = sim_peak(&w1);
+		// Start at a random point of the cycle
+		sim_advance(fmod(ph + 360.0, 97.0) / 97.0 / f / SIM_TICK);
+		gz_avg_reset(&gza);
+		phase_gz = 0;
+
+		if (ph == -180)
+		{
+			// New signal: let the deadline and thresholds settle first
+			Lock_Reset();
+			sim_timeout(HANG_S);
+			if (setjmp(sim_hang)) { hangs++; continue; }
+			for (r = 0; r < WARMUP; r++) reading(&m);
+		}
+
+		for (r = 0; r < READINGS; r++)
+		{
+			double t = sim_now();
+			sim_timeout(HANG_S);
+			if (setjmp(sim_hang)) { hangs++; continue; }
+			if (reading(&m))
+			{
+				gz_avg_add(&gza, &gzc, gz_buf1, gz_buf2, GZ_N);
+				phase_gz = wrap(gz_phase(&gza) + (360.0 * skew) / block_period);
+			}
+			t_meas += sim_now() - t;
+			readings++;
+
+			e = m.status ? rel(m.T0, 1.0 / f) : 100.0;
+			if (e > e_t0) e_t0 = e;
+			e = rel(m.v1max, pk1);
+			if (e > e_pk) e_pk = e;
+			e = fabs(wrap(m.phase - ph));
+			thr_ss += e * e;
+			n_thr++;
+			if (e > thr_max) thr_max = e;
+		}
+		if (gza.n)
+		{
+			e = fabs(wrap(phase_gz - ph));
+			gz_ss += e * e;
+			n_gz++;
+			if (e > gz_max) gz_max = e;
+		}
+
+		sim_timeout(HANG_S);
+		if (setjmp(sim_hang)) { hangs++; continue; }
+		Window_Stop();
+		full = Measure_Full_Period(&meas_ch2, &vmax);
+		e = rel(full * SIM_TICK, 1.0 / f);
+		if (e > e_full) e_full = e;
+	}
+
+	printf("%7s %9.4f %9.4f %8.3f", label, e_t0, e_full, e_pk);
+	if (n_thr) printf(" %8.3f %8.3f", sqrt(thr_ss / n_thr), thr_max);
+	else printf(" %8s %8s", "-", "-");
+	if (n_gz) printf(" %8.3f %8.3f", sqrt(gz_ss / n_gz), gz_max);
+	else printf(" %8s %8s", "-", "-");
+	printf(" %7.1f %5d\n", t_meas > 0 ? readings / t_meas : 0.0, hangs);
+}
+
+// First rising edge of w after t: up through the band between 30% and
+// 70% of the peak, the thresholds measure.c settles on
+static double first_edge (unsigned char mux, const sim_wave *w, double t)
+{
+	double pk = sim_peak(w), v;
+	int band = 0;
+
+	for (;; t += 1e-6)
+	{
+		v = sim_volts(mux, t);
+		if (v <= 0.3 * pk) band = 0;
+		else if (v < 0.7 * pk && band == 0) band = 1;
+		else if (v >= 0.7 * pk && band == 1) return t;
+		else if (v >= 0.7 * pk) band = 2;
+	}
+}
+
+// One input (or both) disconnected for a while, readings back to back;
+// returns 0 if a return took longer than BACK_MAX
+static int probe_off (const char *name, unsigned char off, sim_wave w1, sim_wave w2)
+{
+	meas_result m;
+	unsigned char keep, want = MEAS_CH1 | MEAS_CH2;
+	int k;
+	double t, until, edge, t_long = 0, back, back_max = 0, edge_max = 0, ph, ph_max = 0;
+	static int lost, readings;
+
+	lost = readings = 0;
+	keep = want & ~off;
+	w1.freq = w2.freq = 60.0;
+	w1.phase = 30.0;
+	for (k = 0; k < OFF_PHASES; k++)
+	{
+		sim_reset(off * OFF_PHASES + k);
+		Window_Stop();
+		until = OFF_UNTIL + k / (OFF_PHASES * 60.0);
+		if (off & MEAS_CH1) { w1.off_from = OFF_FROM; w1.off_until = until; }
+		if (off & MEAS_CH2) { w2.off_from = OFF_FROM; w2.off_until = until; }
+		sim_set_wave(CH1, &w1);
+		sim_set_wave(CH2, &w2);
+		edge = until;
+		if (off & MEAS_CH1) edge = first_edge(CH1, &w1, until);
+		if (off & MEAS_CH2) { t = first_edge(CH2, &w2, until); if (t > edge) edge = t; }
+		back = -1;
+
+		sim_timeout(HANG_S);
+		if (setjmp(sim_hang)) { printf("%-10s hang\n", name); return 0; }
+		while (sim_now() < OFF_END)
+		{
+			t = sim_now();
+			reading(&m);
+			if (t >= OFF_FROM && sim_now() < until)
+			{
+				readings++;
+				if ((m.status & keep) != keep) lost++;
+				if (sim_now() - t > t_long) t_long = sim_now() - t;
+			}
+			if (back < 0 && t_edges > until && m.status == want)
+			{
+				back = t_edges - until;
+				if (back > back_max) back_max = back;
+				if (t_edges - edge > edge_max) edge_max = t_edges - edge;
+				ph = fabs(wrap(m.phase - 30.0));
+				if (ph > ph_max) ph_max = ph;
+			}
+		}
+		if (back < 0) back_max = edge_max = OFF_END;
+	}
+	printf("%-10s %10.1f %5d/%-5d %11.2f %11.2f %8.2f\n", name, t_long * 1000.0, lost, readings,
+	       back_max * 60.0, edge_max * 60.0, ph_max);
+	if (edge_max * 60.0 <= BACK_MAX) return 1;
+	printf("FAIL: %s back %.2f periods after its first edge, over %.2f\n", name,
+	       edge_max * 60.0, BACK_MAX);
+	return 0;
+}
+
+int main (int argc, char **argv)
+{
+	sim_wave w1, w2, a1, a2;
+	char label[16];
+	int i, ok;
+
+	memset(&w1, 0, sizeof(w1));
+	w1.amp = 2.1;
+	w1.halfwave = 1;
+	w2 = w1;
+	w2.amp = 0.77;
+
+	for (i = 1; i + 1 < argc; i += 2)
+	{
+		double v = atof(argv[i+1]);
+		if      (!strcmp(argv[i], "-n")) w1.noise = w2.noise = v;
+		else if (!strcmp(argv[i], "-o")) w1.dc = w2.dc = v;
+		else if (!strcmp(argv[i], "-3")) w1.harm[3] = w2.harm[3] = v;
+		else if (!strcmp(argv[i], "-a")) w1.amp = v;
+		else if (!strcmp(argv[i], "-b")) w2.amp = v;
+		else if (!strcmp(argv[i], "-c")) conv = v;
+		else if (!strcmp(argv[i], "-w")) window = (int)v;
+		else if (!strcmp(argv[i], "-k")) lock = (int)v;
+		else if (!strcmp(argv[i], "-e")) meas_edge = (unsigned char)v;
+		else if (!strcmp(argv[i], "-p")) meas_block = (unsigned char)v;
+		else { fprintf(stderr, "unknown option %s\n", argv[i]); return 1; }
+	}
+
+	printf("CH1 %.3fV  CH2 %.3fV  noise %.4fV  dc %.3fV  h3 %.3f  conv %.1fus\n"
+	       "edges %s, profiles edge %d block %d\n\n", w1.amp, w2.amp, w1.noise, w1.dc,
+	       w1.harm[3], conv, window ? "window" : "polled", meas_edge, meas_block);
+	InitADC();
+	printf("%7s %9s %9s %8s %8s %8s %8s %8s %7s %5s\n", "f (Hz)", "T0 err%", "full err%",
+	       "pk err%", "thr rms", "thr max", "gz rms", "gz max", "rd/s", "hang");
+	for (i = 0; i < (int)(sizeof(freqs) / sizeof(freqs[0])); i++)
+	{
+		sprintf(label, "%.0f", freqs[i]);
+		sweep_row(label, freqs[i], w1, w2);
+	}
+
+	printf("\n%7s\n", "60 Hz, amplitude x");
+	for (i = 0; i < (int)(sizeof(scales) / sizeof(scales[0])); i++)
+	{
+		a1 = w1;
+		a2 = w2;
+		a1.amp *= scales[i];
+		a2.amp *= scales[i];
+		sprintf(label, "x%.2f", scales[i]);
+		sweep_row(label, 60.0, a1, a2);
+	}
+
+	printf("\n%-10s %10s %11s %11s %11s %8s\n", "probe off", "worst ms", "other lost",
+	       "back (per)", "edge (per)", "ph err");
+	ok = probe_off("CH1", MEAS_CH1, w1, w2);
+	ok &= probe_off("CH2", MEAS_CH2, w1, w2);
+	ok &= probe_off("both", MEAS_CH1 | MEAS_CH2, w1, w2);
+	return !ok;
+}
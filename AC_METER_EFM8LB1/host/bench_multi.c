@@ -0,0 +1,134 @@
+// bench_multi.c:  Accuracy of the multi-channel mode (multi.c)
+//
+// Runs a reading, Capture_Block() with all five inputs scanned and
+// multi_analyze() against sim.c, the loop of FULLY_WORKING.c with 'm':
+// below MULTI_SLOW_HZ the blocks are MULTI_SLOW_CYCLES periods, each
+// timed by multi_next() of the one before instead of a reading.
+// CH2 is the reference at phase 0; CH1, CH3 and CH4 are three phases at
+// 0, -120 and +120 degrees with different amplitudes, and CH5 is left
+// unconnected and must read "No signal".  For every frequency, over
+// READINGS readings after WARMUP:
+//
+//   rms err   - worst V_RMS error of the four inputs, percent
+//   f err     - worst frequency error, percent
+//   ph rms/max - phase error of CH1, CH3 and CH4, degrees
+//   ms/rd     - simulated time per reading and block, or per block alone
+//               below MULTI_SLOW_HZ (no math, report or display time)
+//   ch5       - readings where CH5 wrongly showed a signal
+//
+// Usage:  bench_multi [-n noise_V] [-c conv_us]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sim.h"
+#include "sim/EFM8LB1.h"
+#include "goertzel.h"
+#include "measure.h"
+#include "multi.h"
+
+#define READINGS 20
+#define WARMUP   4
+#define HANG_S   30.0
+
+static double freqs[] = { 3, 5, 8, 10, 20, 45, 50, 60, 100, 200, 400, 480 };
+static double amps[SCAN_MAX]   = { 1.5, 0.77, 1.2, 0.9, 0 };
+static double phases[SCAN_MAX] = { 0, 0, -120, 120, 0 };
+static unsigned char pins[SCAN_MAX] = { CH1, CH2, CH3, CH4, CH5 };
+
+static double wrap (double d)
+{
+	while (d > 180.0)   d -= 360.0;
+	while (d <= -180.0) d += 360.0;
+	return d;
+}
+
+int main (int argc, char **argv)
+{
+	sim_wave w;
+	meas_result m;
+	multi_result r;
+	gz_coef gzc, gzc_slow;
+	unsigned long next, block;
+	unsigned char cycles;
+	double noise = 0, conv = 5.0, e, t;
+	int i, k, fi;
+	static int n, n_ph, ch5, misses;
+	static double e_rms, e_f, ph_ss, ph_max, t_sum;
+
+	for (i = 1; i + 1 < argc; i += 2)
+	{
+		if      (!strcmp(argv[i], "-n")) noise = atof(argv[i+1]);
+		else if (!strcmp(argv[i], "-c")) conv = atof(argv[i+1]);
+		else { fprintf(stderr, "unknown option %s\n", argv[i]); return 1; }
+	}
+
+	printf("noise %.4fV  conv %.1fus\n\n", noise, conv);
+	printf("%7s %8s %8s %8s %8s %8s %5s %5s\n", "f (Hz)", "rms err%", "f err%",
+	       "ph rms", "ph max", "ms/rd", "ch5", "miss");
+	gz_setup(&gzc, GZ_CYCLES, GZ_N);
+	gz_setup(&gzc_slow, MULTI_SLOW_CYCLES, GZ_N);
+	scan_n = SCAN_MAX;
+
+	for (fi = 0; fi < (int)(sizeof(freqs) / sizeof(freqs[0])); fi++)
+	{
+		sim_reset(fi + 1);
+		sim_conv_us(conv);
+		InitADC();
+		for (k = 0; k < SCAN_MAX; k++)
+		{
+			memset(&w, 0, sizeof(w));
+			w.freq = freqs[fi];
+			w.amp = amps[k];
+			w.phase = phases[k];
+			w.halfwave = 1;
+			w.noise = noise;
+			sim_set_wave(pins[k], &w);
+		}
+		multi_reset();
+		e_rms = e_f = ph_ss = ph_max = t_sum = 0;
+		n = n_ph = ch5 = misses = 0;
+		next = 0;
+
+		sim_timeout(HANG_S * (READINGS + WARMUP));
+		if (setjmp(sim_hang)) { printf("%7.0f hang\n", freqs[fi]); continue; }
+		for (i = 0; i < WARMUP + READINGS; i++)
+		{
+			t = sim_now();
+			if (next) m.period_ticks = next;
+			else Measure_Phase(&m);
+			next = 0;
+			cycles = multi_slow(m.period_ticks) ? MULTI_SLOW_CYCLES : GZ_CYCLES;
+			block = m.period_ticks / (GZ_CYCLES / cycles);
+			if (!m.status || !Block_Fits(block))
+			{
+				if (i >= WARMUP) misses++;
+				continue;
+			}
+			Capture_Block(block);
+			multi_analyze(&r, cycles == GZ_CYCLES ? &gzc : &gzc_slow, m.period_ticks, cycles);
+			if (cycles != GZ_CYCLES) next = multi_next(&r);
+			if (i < WARMUP) continue;
+			t_sum += sim_now() - t;
+			n++;
+			if (r.ch[4].ok) ch5++;
+			for (k = 0; k < 4; k++)
+			{
+				if (!r.ch[k].ok) { misses++; continue; }
+				e = fabs(r.ch[k].vrms - amps[k] / sqrt(2.0)) / (amps[k] / sqrt(2.0)) * 100.0;
+				if (e > e_rms) e_rms = e;
+				e = fabs(r.ch[k].f - freqs[fi]) / freqs[fi] * 100.0;
+				if (e > e_f) e_f = e;
+				if (k == MULTI_REF) continue;
+				e = fabs(wrap(r.ch[k].phase - phases[k]));
+				ph_ss += e * e;
+				n_ph++;
+				if (e > ph_max) ph_max = e;
+			}
+		}
+		printf("%7.0f %8.3f %8.4f %8.3f %8.3f %8.1f %5d %5d\n", freqs[fi], e_rms, e_f,
+		       n_ph ? sqrt(ph_ss / n_ph) : 0, ph_max, n ? t_sum / n * 1000.0 : 0, ch5, misses);
+	}
+	return 0;
+}
@@ -0,0 +1,224 @@
+// bench_pq.c:  Power-quality event detection (pq.c) against the simulated inputs
+//
+// Runs the loop of FULLY_WORKING.c on the phase screen: a reading, its
+// block, then -r ms of report, LCD and waitms() without a conversion of
+// its own, while Timer4 runs pq.c.  Each trial starts the detector on
+// steady inputs, puts one event on CH1 at a random time SETTLE_S or
+// more later, and reads the log when it is over:
+//
+//   found     - trials whose event was logged on CH1 with the right type
+//   extra     - other events logged, either channel
+//   dur err   - logged duration less the event's, cycles (worst)
+//   ext err   - logged extreme less the event's depth, percent of the
+//               reference (worst)
+//   t err     - logged time less the event's start, ms (worst)
+//   flagged   - incomplete half-cycles, all trials
+//
+// A steady QUIET_S run with the noise of -n then counts false events.
+// The inputs are half-wave rectified: half a cycle of dip in the half
+// the rectifier blocks changes nothing, so the events are whole cycles.
+// With -w 1 the edges come from window runs (FULLY_WORKING.c with 'e'),
+// which Timer4_ISR() stops for its pairs.  With -s 1 the loop is the scope
+// screen's instead: a reading, its block and SCOPE_BURST frames back to
+// back, the pairs coming from the captures, the frames queued for
+// SCOPE_BAUD behind SERIAL_TX_SIZE bytes of buffer.
+//
+// Usage:  bench_pq [-f Hz] [-n noise_V] [-r report_ms] [-w 0|1] [-s 0|1]
+//                  [-N trials]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sim.h"
+#include "sim/EFM8LB1.h"
+#include "goertzel.h"
+#include "measure.h"
+#include "pq.h"
+#include "scope.h"
+#include "serial.h"
+
+#define SETTLE_S 1.0
+#define AFTER_S  0.5   // Run on after the event
+#define QUIET_S  60.0
+#define HANG_S   30.0
+
+static struct
+{
+	const char *name;
+	double scale, cycles;
+	unsigned char type;
+} kinds[] =
+{
+	{ "dip to 50%, 1 cycle",     0.50,  1, PQ_DIP_EV },
+	{ "dip to 80%, 3 cycles",    0.80,  3, PQ_DIP_EV },
+	{ "dip to 87%, 10 cycles",   0.87, 10, PQ_DIP_EV },
+	{ "swell to 115%, 1 cycle",  1.15,  1, PQ_SWELL_EV },
+	{ "swell to 120%, 5 cycles", 1.20,  5, PQ_SWELL_EV },
+	{ "interruption, 2 cycles",  0.00,  2, PQ_INTERRUPT_EV },
+	{ "interruption, 30 cycles", 0.00, 30, PQ_INTERRUPT_EV },
+};
+
+static sim_wave w1, w2;
+static double f = 60.0, report_ms = 575.0;
+static int window, scope_mode;
+static long flagged;
+static double tx_free;  // When the queued bytes are all out, seconds
+
+// UART0 at SCOPE_BAUD: a write only waits for room in the queue
+void serial_write (char *p, unsigned int n)
+{
+	double now = sim_now(), byte = 10.0 / SCOPE_BAUD;
+
+	(void)p;
+	if (tx_free < now) tx_free = now;
+	tx_free += n * byte;
+	if (tx_free - now > SERIAL_TX_SIZE * byte)
+		sim_advance((tx_free - now - SERIAL_TX_SIZE * byte) / SIM_TICK);
+}
+
+// One pass of the main loop
+static void loop (void)
+{
+	meas_result m;
+	int i;
+
+	if (window) Measure_Window(&m);
+	else Measure_Phase(&m);
+	if (m.status) pq_period(m.period_ticks);
+	if (m.status == (MEAS_CH1 | MEAS_CH2) && Block_Fits(m.period_ticks))
+	{
+		Capture_Block(m.period_ticks);
+		if (window) Window_Start();
+	}
+	if (!scope_mode)
+	{
+		sim_advance(report_ms * 1e-3 / SIM_TICK);
+		return;
+	}
+	if (window) Window_Stop();
+	for (i = 0; i < SCOPE_BURST; i++) Scope_Frame(m.status ? m.period_ticks : 0);
+}
+
+static void start (unsigned long seed)
+{
+	sim_reset(seed);
+	sim_set_wave(CH1, &w1);
+	sim_set_wave(CH2, &w2);
+	InitADC();
+	Window_Stop();
+	Scope_Reset();
+	tx_free = 0;
+	pq_start();
+}
+
+static double volts (unsigned int rms)
+{
+	return rms == PQ_FLAGGED ? 0 : pq_volts(rms);
+}
+
+static void totals (void)
+{
+	pq_status s;
+
+	pq_get_status(&s);
+	flagged += s.flagged;
+}
+
+int main (int argc, char **argv)
+{
+	pq_event e;
+	pq_status s;
+	sim_wave w;
+	double t_ev, len, x, d_dur, d_ext, d_t;
+	int i, j, k, trials = 20, found, extra, hit;
+	double noise = 0.0;
+	float ph;
+
+	memset(&w1, 0, sizeof(w1));
+	w1.amp = 2.1;
+	w1.halfwave = 1;
+	w1.phase = 30.0;
+	w2 = w1;
+	w2.amp = 0.77;
+	w2.phase = 0;
+
+	for (i = 1; i + 1 < argc; i += 2)
+	{
+		if      (!strcmp(argv[i], "-f")) f = atof(argv[i+1]);
+		else if (!strcmp(argv[i], "-n")) noise = atof(argv[i+1]);
+		else if (!strcmp(argv[i], "-r")) report_ms = atof(argv[i+1]);
+		else if (!strcmp(argv[i], "-w")) window = atoi(argv[i+1]);
+		else if (!strcmp(argv[i], "-s")) scope_mode = atoi(argv[i+1]);
+		else if (!strcmp(argv[i], "-N")) trials = atoi(argv[i+1]);
+		else { fprintf(stderr, "unknown option %s\n", argv[i]); return 1; }
+	}
+	w1.freq = w2.freq = f;
+	w1.noise = w2.noise = noise;
+	sim_timer4_isr = Timer4_ISR;
+	srand(1);
+
+	if (scope_mode) printf("%.1f Hz  noise %.4fV  scope  edges %s  %d trials\n\n", f, noise,
+	                       window ? "window" : "polled", trials);
+	else printf("%.1f Hz  noise %.4fV  report %.0f ms  edges %s  %d trials\n\n", f, noise,
+	            report_ms, window ? "window" : "polled", trials);
+	printf("%-24s %6s %6s %8s %8s %8s\n", "event on CH1", "found", "extra",
+	       "dur err", "ext err", "t err");
+
+	for (k = 0; k < (int)(sizeof(kinds) / sizeof(kinds[0])); k++)
+	{
+		found = extra = 0;
+		d_dur = d_ext = d_t = 0;
+		for (i = 0; i < trials; i++)
+		{
+			len = kinds[k].cycles / f;
+			t_ev = SETTLE_S + rand() * 1.0 / RAND_MAX;
+			w = w1;
+			w.step_from = t_ev;
+			w.step_until = t_ev + len;
+			w.step_scale = kinds[k].scale;
+			start(k * 1000 + i + 1);
+			sim_set_wave(CH1, &w);
+
+			sim_timeout(HANG_S);
+			if (setjmp(sim_hang)) { printf("%-24s hang\n", kinds[k].name); break; }
+			while (sim_now() < t_ev + len + AFTER_S) loop();
+
+			totals();
+			hit = 0;
+			for (j = 0; pq_get_event(j, &e); j++)
+			{
+				if (!hit && e.chan == 0 && e.type == kinds[k].type)
+				{
+					hit = 1;
+					found++;
+					x = e.halves / 2.0 - kinds[k].cycles;
+					if (fabs(x) > fabs(d_dur)) d_dur = x;
+					x = 100.0 * e.extreme / e.ref - 100.0 * kinds[k].scale;
+					if (fabs(x) > fabs(d_ext)) d_ext = x;
+					x = e.t_ms - t_ev * 1000.0;
+					if (fabs(x) > fabs(d_t)) d_t = x;
+				}
+				else extra++;
+			}
+		}
+		printf("%-24s %3d/%-2d %6d %8.1f %8.1f %8.1f\n", kinds[k].name, found, trials, extra,
+		       d_dur, d_ext, d_t);
+	}
+
+	start(99);
+	sim_timeout(QUIET_S + HANG_S);
+	if (setjmp(sim_hang)) { printf("quiet run hang\n"); return 1; }
+	while (sim_now() < QUIET_S) loop();
+	totals();
+	pq_get_status(&s);
+	printf("\nquiet %.0f s: %u false events, %lu half-cycles, RMS(1/2) CH1 %.4f V CH2 %.4f V"
+	       " (true %.4f, %.4f; 0 = flagged)\n", QUIET_S, s.count, s.halves, volts(s.rms[0]),
+	       volts(s.rms[1]), w1.amp / sqrt(2.0), w2.amp / sqrt(2.0));
+	printf("phase from the crossings: ");
+	if (pq_phase(&ph)) printf("%+.2f deg", ph);
+	else printf("none");
+	printf(" (true %+.2f)\n", w1.phase - w2.phase);
+	printf("flagged half-cycles, all runs: %ld\n", flagged);
+	return 0;
+}
@@ -0,0 +1,101 @@
+// bench_scope.c:  Scope mode frames from the simulated inputs
+//
+// Runs scope.c and Capture_Triggered() (measure.c) against sim.c the way
+// FULLY_WORKING.c does in scope mode, a reading then SCOPE_BURST frames,
+// and writes the frames to stdout where UART0 would send them:
+//
+//   ./bench_scope -f 60 | ./scope_rx -o blocks.csv -
+//
+// On stderr: frames whose trigger pair is not the first at or past the
+// level on the trigger slope, untriggered (forced) frames, and the frame
+// rate and byte rate against what SCOPE_BAUD carries.  The keys given with
+// -k go to Scope_Key() first, e.g. -k '2c\64t' for CH2 falling, 64 pairs
+// of pre-trigger.
+//
+// Usage:  bench_scope [-f Hz] [-x ch1_phase_deg] [-n noise_V] [-N frames]
+//                     [-k keys]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "sim/EFM8LB1.h"
+#include "measure.h"
+#include "scope.h"
+
+#define HANG_S 30.0
+
+extern scope_trig scope;
+
+// UART0 of the firmware
+void serial_write (char *p, unsigned int n)
+{
+	fwrite(p, 1, n, stdout);
+}
+
+// Whether the pair at scope.pre is where the trigger belongs
+static int trigger_ok (void)
+{
+	int *x = (scope.pin == CH2) ? scope_buf2 : scope_buf1;
+	int a = x[(scope.start + scope.pre - 1) & (SCOPE_N - 1)];
+	int b = x[(scope.start + scope.pre) & (SCOPE_N - 1)];
+	int level = scope.level;
+
+	if (scope.pre == 0) return 1;  // Nothing before it to check against
+	return scope.falling ? (a > level && b <= level) : (a < level && b >= level);
+}
+
+int main (int argc, char **argv)
+{
+	sim_wave w1, w2;
+	meas_result m;
+	double f = 60.0;
+	char *keys = "";
+	static int frames = 100, done, misplaced, forced, i;
+
+	memset(&w1, 0, sizeof(w1));
+	w1.amp = 2.1;
+	w1.halfwave = 1;
+	w1.phase = 30.0;
+	w2 = w1;
+	w2.amp = 0.77;
+	w2.phase = 0;
+
+	for (i = 1; i + 1 < argc; i += 2)
+	{
+		if      (!strcmp(argv[i], "-f")) f = atof(argv[i+1]);
+		else if (!strcmp(argv[i], "-x")) w1.phase = atof(argv[i+1]);
+		else if (!strcmp(argv[i], "-n")) w1.noise = w2.noise = atof(argv[i+1]);
+		else if (!strcmp(argv[i], "-N")) frames = atoi(argv[i+1]);
+		else if (!strcmp(argv[i], "-k")) keys = argv[i+1];
+		else { fprintf(stderr, "unknown option %s\n", argv[i]); return 1; }
+	}
+
+	sim_reset(1);
+	w1.freq = w2.freq = f;
+	sim_set_wave(CH1, &w1);
+	sim_set_wave(CH2, &w2);
+	InitADC();
+	Scope_Reset();
+	while (*keys) Scope_Key(*keys++);
+
+	sim_timeout(HANG_S * frames);
+	if (setjmp(sim_hang)) { fprintf(stderr, "hang after %d frames\n", done); return 1; }
+	while (done < frames)
+	{
+		Measure_Phase(&m);
+		for (i = 0; i < SCOPE_BURST && done < frames; i++, done++)
+		{
+			Scope_Frame(m.status ? m.period_ticks : 0);
+			if (scope.forced) forced++;
+			else if (!trigger_ok()) misplaced++;
+		}
+	}
+	fflush(stdout);
+
+	fprintf(stderr, "%d frames, %d misplaced triggers, %d forced; %.3f us/pair\n"
+	        "%.1f frames/s, %.0f bytes/s of the %.0f SCOPE_BAUD carries\n",
+	        frames, misplaced, forced, scope.interval * SIM_TICK * 1e6,
+	        frames / sim_now(), frames * (16.0 + 4 * SCOPE_N) / sim_now(), SCOPE_BAUD / 10.0);
+	return 0;
+}
@@ -0,0 +1,219 @@
+// scope_rx.c:  Linux receiver for the scope mode of the AC meter
+//
+// Opens the meter's serial port at 115200 baud, sends the scope settings
+// and 's', then switches to SCOPE_BAUD and saves every good frame (see
+// scope.h) until -n frames or Ctrl-C, when it sends 'p' to put the meter
+// back on its text reports.  With "-" for the port it decodes a byte
+// stream from stdin instead: frames saved with -r, or bench_scope.
+//
+// The CSV output (-o, default stdout) has a comment line per frame and a
+// line per pair:
+//
+//   # frame 12 seq 140 CH1 rising 1.250 V pre 64 25.000 us/pair
+//   12,-1600.000,0.01934,0.71023
+//
+// t_us is CH1's sample time from the trigger pair; CH2's is half a pair
+// later.  A "forced" frame found no edge in time and is not triggered.
+// Reads are large and the output is buffered, so the program keeps up
+// with 3 Mbaud of frames; lost frames (gaps in seq) and bad checksums are
+// counted and printed on stderr at the end.
+//
+// Usage:  scope_rx [-c 1|2] [-f] [-l mV] [-t pre] [-i us] [-n frames]
+//                  [-o file.csv] [-r file.bin] port|-
+//         -c trigger channel, -f falling edge, -l level (0 = automatic),
+//         -t pairs before the trigger, -i us per pair (0 = automatic)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+
+// From the firmware (FULLY_WORKING.c, scope.h, measure.h)
+#define TEXT_BAUD  B115200
+#define SCOPE_BAUD B3000000
+#define SYNC1      0xA5
+#define SYNC2      0x5A
+#define F_CH2      0x01
+#define F_FALLING  0x02
+#define F_FORCED   0x04
+#define TICK_US    (12.0 / 72.0)
+#define VDD        3.3
+
+#define HEAD      14        // Bytes before the samples
+#define MAX_PAIRS 4096      // Larger n is a false sync
+#define BUF_SIZE  (1 << 16)
+
+static volatile sig_atomic_t stop;
+static unsigned char buf[BUF_SIZE];
+static unsigned long frames, bad, lost;
+
+static void on_signal (int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static int set_baud (int fd, speed_t baud)
+{
+	struct termios t;
+
+	if (tcgetattr(fd, &t) < 0) return -1;
+	cfmakeraw(&t);
+	t.c_cflag |= CLOCAL | CREAD;
+	t.c_cflag &= ~(CSTOPB | CRTSCTS);
+	t.c_cc[VMIN] = 0;
+	t.c_cc[VTIME] = 1;  // Reads return every 0.1 s at most, for Ctrl-C
+	cfsetispeed(&t, baud);
+	cfsetospeed(&t, baud);
+	if (tcsetattr(fd, TCSANOW, &t) < 0) return -1;
+	tcflush(fd, TCIOFLUSH);
+	return 0;
+}
+
+static void send (int fd, const char *s)
+{
+	if (write(fd, s, strlen(s)) < 0) perror("write");
+	tcdrain(fd);
+}
+
+static unsigned int word (const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+// Fletcher-16 as in scope.c: sum1 in the low byte, sum2 in the high one
+static unsigned int fletcher (const unsigned char *p, unsigned int n)
+{
+	unsigned int s1 = 0, s2 = 0;
+
+	while (n--)
+	{
+		s1 = (s1 + *p++) % 255;
+		s2 = (s2 + s1) % 255;
+	}
+	return s1 | (s2 << 8);
+}
+
+static void save (FILE *out, const unsigned char *f)
+{
+	static int last_seq = -1;
+	unsigned int i, n = word(f + 4), pre = word(f + 6);
+	double dt = word(f + 8) * TICK_US;
+	double scale = VDD / word(f + 12);
+	const unsigned char *s = f + HEAD;
+
+	if (last_seq >= 0) lost += (f[2] - last_seq - 1) & 0xFF;
+	last_seq = f[2];
+
+	fprintf(out, "# frame %lu seq %u CH%c %s %.3f V pre %u %.3f us/pair%s\n",
+	        frames, f[2], (f[3] & F_CH2) ? '2' : '1',
+	        (f[3] & F_FALLING) ? "falling" : "rising",
+	        word(f + 10) * scale, pre, dt,
+	        (f[3] & F_FORCED) ? " forced" : "");
+	for (i = 0; i < n; i++, s += 4)
+		fprintf(out, "%lu,%.3f,%.5f,%.5f\n", frames, ((double)i - pre) * dt,
+		        word(s) * scale, word(s + 2) * scale);
+	frames++;
+}
+
+// Decode the frames in buf[0..len), saving the good ones; returns how
+// many bytes at the start are used up
+static size_t decode (const unsigned char *b, size_t len, FILE *out, FILE *raw)
+{
+	size_t i = 0, size;
+	unsigned int n;
+
+	while (i + HEAD <= len)
+	{
+		if (b[i] != SYNC1 || b[i + 1] != SYNC2) { i++; continue; }
+		n = word(b + i + 4);
+		if (n == 0 || n > MAX_PAIRS) { i++; continue; }
+		size = HEAD + 4 * (size_t)n + 2;
+		if (i + size > len) break;  // The rest has not arrived yet
+		if (fletcher(b + i + 2, size - 4) != word(b + i + size - 2))
+		{
+			bad++;
+			i++;
+			continue;
+		}
+		if (raw) fwrite(b + i, 1, size, raw);
+		save(out, b + i);
+		i += size;
+	}
+	return i;
+}
+
+static void usage (void)
+{
+	fprintf(stderr, "usage: scope_rx [-c 1|2] [-f] [-l mV] [-t pre] [-i us] [-n frames]\n"
+	                "                [-o file.csv] [-r file.bin] port|-\n");
+	exit(1);
+}
+
+int main (int argc, char **argv)
+{
+	int opt, fd, ch = 1, falling = 0, mv = 0, pre = 64, us = 0;
+	unsigned long want = 0;
+	size_t len = 0, used;
+	ssize_t got;
+	char keys[64];
+	FILE *out = stdout, *raw = NULL;
+
+	while ((opt = getopt(argc, argv, "c:fl:t:i:n:o:r:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'c': ch = atoi(optarg); break;
+			case 'f': falling = 1; break;
+			case 'l': mv = atoi(optarg); break;
+			case 't': pre = atoi(optarg); break;
+			case 'i': us = atoi(optarg); break;
+			case 'n': want = strtoul(optarg, NULL, 0); break;
+			case 'o': if (!(out = fopen(optarg, "w"))) { perror(optarg); return 1; } break;
+			case 'r': if (!(raw = fopen(optarg, "wb"))) { perror(optarg); return 1; } break;
+			default: usage();
+		}
+	}
+	if (optind != argc - 1) usage();
+
+	if (strcmp(argv[optind], "-") == 0) fd = 0;
+	else
+	{
+		fd = open(argv[optind], O_RDWR | O_NOCTTY);
+		if (fd < 0) { perror(argv[optind]); return 1; }
+		// A meter left in scope mode only hears SCOPE_BAUD
+		if (set_baud(fd, SCOPE_BAUD) < 0) { perror("termios"); return 1; }
+		send(fd, "p");
+		usleep(100000);
+		set_baud(fd, TEXT_BAUD);
+		snprintf(keys, sizeof(keys), "%dc%c%dl%dt%dis", ch, falling ? '\\' : '/', mv, pre, us);
+		send(fd, keys);
+		set_baud(fd, SCOPE_BAUD);
+	}
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	while (!stop && (want == 0 || frames < want))
+	{
+		got = read(fd, buf + len, sizeof(buf) - len);
+		if (got < 0) { perror("read"); break; }
+		if (got == 0)
+		{
+			if (fd == 0) break;  // End of the file
+			continue;
+		}
+		len += got;
+		used = decode(buf, len, out, raw);  // A frame fits well within buf
+		memmove(buf, buf + used, len - used);
+		len -= used;
+	}
+
+	if (fd != 0) send(fd, "p");
+	fflush(out);
+	if (raw) fclose(raw);
+	fprintf(stderr, "%lu frames, %lu lost, %lu bad checksums\n", frames, lost, bad);
+	return 0;
+}
@@ -0,0 +1,258 @@
+// sim.c:  Simulated 14-bit ADC and SYSCLK/12 timers for host builds
+
+#include <math.h>
+#include <string.h>
+#include "sim/EFM8LB1.h"
+#include "../../COMMON_EFM8LB1/timebase.h"
+#include "sim.h"
+
+#define PI 3.14159265358979
+
+sim_u8 SFRPAGE;
+sim_u8 ADEN, ADBMEN, ADBUSY, ADC0MX;
+sim_u8 ADC0CN0, ADC0CN1, ADC0CN2, ADC0CF0, ADC0CF1, ADC0CF2;
+sim_u8 P0MDIN, P1MDIN, P2MDIN, P0SKIP, P1SKIP, P2SKIP;
+sim_u16 ADC0;
+sim_u8 TR0, ET0, TF0;
+sim_u16 TMR0;
+sim_u8 TR2, ET2;
+sim_u16 TMR2, TMR2RL;
+sim_u8 EIE1, ADWINT;
+sim_u16 ADC0GT, ADC0LT;
+sim_u8 TMR3H, TMR3L, TMR3CN0;
+sim_u8 EIE2, TMR4CN0;
+sim_u16 TMR4, TMR4RL;
+volatile unsigned long tb_ms;
+
+jmp_buf sim_hang;
+void (*sim_timer4_isr)(void);
+
+static sim_wave waves[SIM_MUX_SIZE];
+static sim_u8 adint, tf2h;
+static double now;          // Ticks
+static double conv_ticks;   // Per conversion, including the firmware around it
+static double deadline;     // Ticks, 0 = none
+static double t4_next;      // Ticks of the next Timer4 overflow, 0 = not running
+static sim_u8 t4_pending, t4_in_isr;
+static unsigned long long rng;
+
+static double urand (void)
+{
+	rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+	return (rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double grand (void)
+{
+	double u = urand() + 1e-300, v = urand();
+	return sqrt(-2.0 * log(u)) * cos(2.0 * PI * v);
+}
+
+void sim_reset (unsigned long seed)
+{
+	memset(waves, 0, sizeof(waves));
+	now = 0;
+	deadline = 0;
+	conv_ticks = 5.0e-6 / SIM_TICK;
+	rng = 0x2545F4914F6CDD1DULL ^ seed;
+	adint = tf2h = 0;
+	ADBUSY = TR0 = TF0 = TR2 = 0;
+	TMR0 = TMR2 = TMR2RL = 0;
+	ADC0CN2 = EIE1 = ADWINT = 0;
+	EIE2 = TMR4CN0 = 0;
+	TMR4 = TMR4RL = 0;
+	t4_next = 0;
+	t4_pending = t4_in_isr = 0;
+}
+
+void sim_set_wave (unsigned char mux, const sim_wave *w)
+{
+	waves[mux % SIM_MUX_SIZE] = *w;
+}
+
+void sim_conv_us (double us)
+{
+	conv_ticks = us * 1.0e-6 / SIM_TICK;
+}
+
+void sim_timeout (double seconds)
+{
+	deadline = (seconds > 0) ? now + seconds / SIM_TICK : 0;
+}
+
+double sim_now (void)
+{
+	return now * SIM_TICK;
+}
+
+// Noise-free input voltage at time t (seconds)
+double sim_volts (unsigned char mux, double t)
+{
+	sim_wave *w = &waves[mux % SIM_MUX_SIZE];
+	double th = 2.0 * PI * w->freq * t + w->phase * (PI / 180.0);
+	double v = sin(th);
+	int k;
+
+	if (t >= w->off_from && t < w->off_until) return w->dc;
+	for (k = 2; k <= SIM_HARM; k++)
+		if (w->harm[k] != 0) v += w->harm[k] * sin(k * th);
+	v *= w->amp;
+	if (t >= w->step_from && t < w->step_until) v *= w->step_scale;
+	if (w->halfwave && v < 0) v = 0;
+	return v + w->dc;
+}
+
+// Largest noise-free value over one period
+double sim_peak (const sim_wave *w)
+{
+	sim_wave save = waves[0];
+	double p = -1e9, v;
+	int i;
+
+	waves[0] = *w;
+	for (i = 0; i < 10000; i++)
+	{
+		v = sim_volts(0, i / (10000.0 * w->freq));
+		if (v > p) p = v;
+	}
+	waves[0] = save;
+	return p;
+}
+
+// One result for the input at time t (ticks): ADC0CN1 sets 10/12/14 bits,
+// 1 or 4..64 accumulated conversions (each with its own noise) and the
+// right shift of the sum
+static sim_u16 convert (unsigned char mux, double t)
+{
+	double v;
+	long adc, full = (1L << (10 + 2 * ((ADC0CN1 >> 6) & 3))) - 1, sum = 0;
+	int k, n = (ADC0CN1 & 7) ? 2 << (ADC0CN1 & 7) : 1;
+
+	for (k = 0; k < n; k++)
+	{
+		v = sim_volts(mux, t * SIM_TICK);
+		v += waves[mux % SIM_MUX_SIZE].noise * grand();
+		adc = lround(v * full / SIM_VDD);
+		if (adc < 0) adc = 0;
+		if (adc > full) adc = full;
+		sum += adc;
+	}
+	return (sim_u16)(sum >> ((ADC0CN1 >> 3) & 7));
+}
+
+// tb_ms and TMR3 for an interrupt at tick p
+static void timebase_at (unsigned long p)
+{
+	tb_ms = p / TB_TICKS_PER_MS;
+	TMR3H = (TB_RELOAD + p % TB_TICKS_PER_MS) >> 8;
+	TMR3L = (TB_RELOAD + p % TB_TICKS_PER_MS) & 0xFF;
+}
+
+// Conversion started by a Timer2 overflow at tick t, window compare
+static void trigger (double t)
+{
+	unsigned long p = (unsigned long)t;
+	int hit;
+
+	ADC0 = convert(ADC0MX, t);
+	adint = 1;
+	if (ADC0LT > ADC0GT) hit = (ADC0 > ADC0GT && ADC0 < ADC0LT);
+	else                 hit = (ADC0 < ADC0LT || ADC0 > ADC0GT);
+	if (!hit) return;
+	ADWINT = 1;
+	if (EIE1 & 0x04)
+	{
+		timebase_at(p);
+		ADC0_WC_ISR();
+	}
+}
+
+static void timer4_isr (void)
+{
+	t4_pending = 0;
+	t4_in_isr = 1;
+	timebase_at((unsigned long)now);
+	if (sim_timer4_isr) sim_timer4_isr();
+	t4_in_isr = 0;
+}
+
+static void advance (double ticks);
+
+// Time moves in steps up to each Timer4 overflow, where its interrupt runs
+// (and moves time on with its own conversions)
+void sim_advance (double ticks)
+{
+	double end = now + ticks;
+
+	if (!(TMR4CN0 & 0x04)) t4_next = 0;
+	else if (t4_next == 0) t4_next = floor(now) + (0x10000UL - TMR4);
+	while (t4_next && t4_next <= end)
+	{
+		if (t4_next > now) advance(t4_next - now);
+		t4_next += 0x10000UL - TMR4RL;
+		t4_pending = 1;
+		if (!t4_in_isr && (EIE2 & 0x04)) timer4_isr();
+		if (!(TMR4CN0 & 0x04)) t4_next = 0;
+	}
+	if (end > now) advance(end - now);
+	if (t4_pending && !t4_in_isr && (EIE2 & 0x04)) timer4_isr();
+}
+
+static void advance (double ticks)
+{
+	unsigned long n, r, done = 0;
+	double t0 = floor(now);
+
+	n = (unsigned long)(floor(now + ticks) - t0);
+	now += ticks;
+	if (deadline && now > deadline) longjmp(sim_hang, 1);
+
+	if (TR0)
+	{
+		if ((unsigned long)TMR0 + n > 0xFFFFUL) TF0 = 1;
+		TMR0 = (sim_u16)(TMR0 + n);
+	}
+	if (TR2)
+	{
+		// 16-bit auto-reload from TMR2RL, TF2H on every overflow
+		while (n)
+		{
+			r = 0x10000UL - TMR2;
+			if (n < r) { TMR2 += n; break; }
+			n -= r;
+			done += r;
+			TMR2 = TMR2RL;
+			tf2h = 1;
+			if ((ADC0CN2 & 0x0F) == 0x02) trigger(t0 + done);
+		}
+	}
+}
+
+sim_u8 *sim_adint (void)
+{
+	sim_u16 adc;
+
+	if (ADBUSY)
+	{
+		adc = convert(ADC0MX, now);
+		sim_advance(conv_ticks);
+		ADC0 = adc;
+		ADBUSY = 0;
+		adint = 1;
+	}
+	else if (!adint && (ADC0CN2 & 0x0F) == 0x02)
+		sim_advance(1.0); // Waiting for a Timer2-started conversion
+	return &adint;
+}
+
+unsigned long Ticks (void)
+{
+	sim_advance(1.0);
+	return (unsigned long)now;
+}
+
+sim_u8 *sim_tf2h (void)
+{
+	sim_advance(1.0);
+	return &tf2h;
+}
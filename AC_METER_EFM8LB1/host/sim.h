@@ -0,0 +1,48 @@
+// sim.h:  Simulated 14-bit ADC and SYSCLK/12 timers for host builds
+//
+// measure.c is compiled against sim/EFM8LB1.h; its SFR accesses land here.
+// Every ADC input mux code can carry a waveform: a fundamental with
+// harmonics, optionally half-wave rectified like the AC meter front end,
+// plus DC offset and Gaussian noise, quantized to 14 bits against VDD.
+// A stretch of it can be scaled (a dip or swell) or disconnected.
+//
+// Simulated time only moves when the firmware polls ADINT or TF2H (or the
+// caller uses sim_advance()), so the busy-wait loops run at the speed the
+// conversion cost set with sim_conv_us() implies.
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <setjmp.h>
+
+#define SIM_TICK  (12.0/72.0e6)  // Timer0/Timer2 tick, seconds
+#define SIM_VDD   3.3
+#define SIM_HARM  9              // Highest harmonic of a waveform
+
+typedef struct
+{
+	double freq;                // Hz
+	double amp;                 // Peak volts of the fundamental
+	double phase;               // Degrees at t = 0
+	double dc;                  // Volts added after rectification
+	double noise;               // Gaussian noise, volts RMS
+	double harm[SIM_HARM+1];    // Harmonic k amplitude relative to the fundamental
+	int    halfwave;            // Clip the negative half like the rectifier
+	double off_from, off_until; // Seconds: input disconnected (dc only) in between
+	double step_from, step_until; // Seconds: amplitude times step_scale in between
+	double step_scale;
+} sim_wave;
+
+extern jmp_buf sim_hang;        // longjmp'ed to with 1 when the timeout expires
+extern void (*sim_timer4_isr)(void);  // Called on Timer4 overflows, see sim/EFM8LB1.h
+
+void   sim_reset (unsigned long seed);
+void   sim_set_wave (unsigned char mux, const sim_wave *w);
+void   sim_conv_us (double us);
+void   sim_timeout (double seconds);
+void   sim_advance (double ticks);
+double sim_now (void);
+double sim_volts (unsigned char mux, double t);
+double sim_peak (const sim_wave *w);
+
+#endif
@@ -0,0 +1,72 @@
+// EFM8LB1.h (host simulation):  SFRs used by measure.c, backed by sim.c
+//
+// Found ahead of the real header by the host Makefile (-Isim).  Plain
+// registers are variables.  The flags firmware spins on are macros that
+// call into the simulator, which advances simulated time on every poll:
+//
+//   ADINT  - a poll after ADBUSY = 1 runs one conversion of the ADC0MX input,
+//            at the resolution, repeat count and shift set in ADC0CN1;
+//            with conversions started by Timer2, a poll that finds it
+//            clear costs one tick
+//   TF2H   - each poll costs one Timer2 tick
+//
+// Timer0 and Timer2 count SYSCLK/12 ticks of simulated time while running.
+// Ticks() of the shared timebase (COMMON_EFM8LB1/timebase.c, not linked)
+// is simulated time; each call costs one tick so loops polling it move on.
+//
+// With ADC0CN2 set to Timer2 overflows, every overflow converts ADC0MX, sets
+// ADINT and applies the ADC0GT/ADC0LT window; with EIE1 bit 2 set a hit calls
+// ADC0_WC_ISR() at once, tb_ms and TMR3 showing that moment.
+//
+// Timer4 (TMR4CN0 bit 2) reloads from TMR4RL.  Each overflow calls the
+// function in sim_timer4_isr (sim.h) if EIE2 bit 2 is set, or as soon as it
+// is set again; like the real interrupt it never interrupts itself.
+
+#ifndef SIM_EFM8LB1_H
+#define SIM_EFM8LB1_H
+
+typedef unsigned char  sim_u8;
+typedef unsigned short sim_u16;
+
+// ADC input mux codes; sim_set_wave() assigns a waveform to each
+#define QFP32_MUX_P2_1 0x11
+#define QFP32_MUX_P2_2 0x12
+#define QFP32_MUX_P2_3 0x13
+#define QFP32_MUX_P2_4 0x14
+#define QFP32_MUX_P2_5 0x15
+#define QFP32_MUX_P2_6 0x16
+#define SIM_MUX_SIZE   0x20
+
+extern sim_u8 SFRPAGE;
+extern sim_u8 ADEN, ADBMEN, ADBUSY, ADC0MX;
+extern sim_u8 ADC0CN0, ADC0CN1, ADC0CN2, ADC0CF0, ADC0CF1, ADC0CF2;
+extern sim_u8 P0MDIN, P1MDIN, P2MDIN, P0SKIP, P1SKIP, P2SKIP;
+extern sim_u16 ADC0;
+extern sim_u8 TR0, ET0, TF0;
+extern sim_u16 TMR0;
+extern sim_u8 TR2, ET2;
+extern sim_u16 TMR2, TMR2RL;
+extern sim_u8 EIE1, ADWINT;
+extern sim_u16 ADC0GT, ADC0LT;
+extern sim_u8 TMR3H, TMR3L, TMR3CN0;
+extern sim_u8 EIE2, TMR4CN0;
+extern sim_u16 TMR4, TMR4RL;
+
+sim_u8 *sim_adint (void);
+sim_u8 *sim_tf2h (void);
+
+#define ADINT (*sim_adint())
+#define TF2H  (*sim_tf2h())
+
+// Interrupt functions are plain functions the simulator calls
+#define interrupt
+#define INTERRUPT_ADC0_WC
+#define INTERRUPT_TIMER4
+void ADC0_WC_ISR (void);
+void Timer4_ISR (void);
+
+// Byte halves of TMR2 (little-endian host)
+#define TMR2L (((sim_u8 *)&TMR2)[0])
+#define TMR2H (((sim_u8 *)&TMR2)[1])
+
+#endif
@@ -14,6 +14,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <EFM8LB1.h>
+#include "../COMMON_EFM8LB1/timebase.h"
 
 // ~C51~  
 
@@ -118,6 +119,9 @@ char _c51_external_startup (void)
 	TMR2    = 0x0000;
 	ET2     = 0;
 
+	// Timer 3 - shared timebase (timebase.c): delays
+	Timebase_Init();
+
 	EA=1;
 	
 	return 0;
@@ -181,29 +185,6 @@ void InitADC (void)
 }
 
 
-void Timer3us(unsigned char us)
-{
-	unsigned char i;
-	CKCON0|=0b_0100_0000;
-	TMR3RL = (-(SYSCLK)/1000000L);
-	TMR3 = TMR3RL;
-	TMR3CN0 = 0x04;
-	for (i = 0; i < us; i++)
-	{
-		while (!(TMR3CN0 & 0x80));
-		TMR3CN0 &= ~(0x80);
-	}
-	TMR3CN0 = 0;
-}
-
-void waitms (unsigned int ms)
-{
-	unsigned int j;
-	unsigned char k;
-	for(j=0; j<ms; j++)
-		for (k=0; k<4; k++) Timer3us(250);
-}
-
 #define VDD 3.3
 
 void InitPinADC (unsigned char portno, unsigned char pinno)
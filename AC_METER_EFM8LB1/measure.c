@@ -0,0 +1,972 @@
+// measure.c:  ADC access and the threshold measurement loop of the AC meter
+//
+// Both inputs are half-wave rectified: a sine arch followed by a flat 0V
+// valley of half a period.  Timer0 and Timer2 run at SYSCLK/12.
+
+#include <stdlib.h>
+#include <math.h>
+#include <EFM8LB1.h>
+#include "goertzel.h"
+#include "measure.h"
+#include "../COMMON_EFM8LB1/timebase.h"
+
+#define PI 3.14159265358979
+
+// XRAM: 512 bytes of sample blocks for the Goertzel, harmonic and power
+// analysis in FULLY_WORKING.c, and the 1 KB ring of raw pairs for
+// scope.c.  Scope frames and the multi-channel scan are never taken
+// together, so the extra inputs of multi.c are sampled into the ring.
+xdata int gz_buf1[GZ_N];
+xdata int gz_buf2[GZ_N];
+xdata int scope_buf1[SCOPE_N];
+xdata int scope_buf2[SCOPE_N];
+volatile unsigned char scope_next; // Capture_Triggered()'s next pair goes here
+
+// Capture_Block() scan schedule: every Timer2 slot converts the first
+// scan_n inputs in this order, CH1 and CH2 always
+code unsigned char scan_pin[SCAN_MAX] = { CH1, CH2, CH3, CH4, CH5 };
+xdata int * code scan_buf[SCAN_MAX] = { gz_buf1, gz_buf2, scope_buf1, scope_buf1 + GZ_N, scope_buf2 };
+unsigned char scan_n = 2;
+unsigned int scan_skew[SCAN_MAX];  // Timer2 ticks each input is converted after CH1
+
+
+// ----------------------------------------------------------------
+// ADC functions
+// ----------------------------------------------------------------
+
+// Acquisition profiles, see measure.h.  ADC0CN1 is ADBITS (7:6, 0 = 10,
+// 1 = 12, 2 = 14 bits), ADSJST (5:3, right shift of the result) and ADRPT
+// (2:0, 1 = 4, 3 = 16 conversions accumulated); ADC0CF1 is the tracking
+// time in SYSCLK periods.  Burst mode runs all the repeats on one start.
+typedef struct
+{
+	unsigned char burst;  // ADBMEN
+	unsigned char cn1;    // ADC0CN1
+	unsigned char cf1;    // ADC0CF1
+	unsigned int  full;   // Full-scale result
+	unsigned int  pair;   // Least Timer2 ticks per Capture_Block() pair
+	unsigned int  guard;  // Timer2 ticks Timer4_ISR() can take: ADC_GUARD + a pair
+} adc_prof;
+
+// The pairs in 'guard' are the conversion times of measure.h in ticks,
+// rounded up
+code adc_prof adc_profiles[] =
+{
+	{ 0, (0x2 << 6) | (0x0 << 3) | 0x0, 0x1E, 0x3FFF, GZ_MIN_INTERVAL, ADC_GUARD + 2 * 8 },   // ADC_AMPL
+	{ 0, (0x1 << 6) | (0x0 << 3) | 0x0, 0x12, 0x0FFF, GZ_MIN_INTERVAL, ADC_GUARD + 2 * 7 },   // ADC_EDGE12
+	{ 0, (0x0 << 6) | (0x0 << 3) | 0x0, 0x12, 0x03FF, GZ_MIN_INTERVAL, ADC_GUARD + 2 * 6 },   // ADC_EDGE10
+	{ 1, (0x2 << 6) | (0x2 << 3) | 0x1, 0x1E, 0x3FFF, GZ_MIN_INTERVAL, ADC_GUARD + 2 * 32 },  // ADC_ACC4:  4 x 14 bits >> 2
+	{ 1, (0x1 << 6) | (0x2 << 3) | 0x3, 0x12, 0x3FFC, 300,             ADC_GUARD + 2 * 99 },  // ADC_ACC16: 16 x 12 bits >> 2
+};
+
+unsigned char adc_profile = 0xFF;  // ADC_... in use
+unsigned int  adc_full = ADC_FULL; // Its full-scale result
+unsigned char meas_edge  = ADC_AMPL;   // Profile for edge waits and window runs
+unsigned char meas_block = ADC_AMPL;   // Profile for peaks and captured blocks
+
+void InitADC (void)
+{
+	SFRPAGE = 0x00;
+	ADEN = 0;
+
+	ADC0CF0 = ((SYSCLK/SARCLK - 1) << 3) | (0x0 << 2); // SARCLK = SYSCLK/(ADSC+1)
+	ADC0CN0 = 0x00;
+
+	ADC0CF2 =
+		(0x0 << 7) |
+		(0x1 << 5) | // reference = VDD
+		(0x1F << 0);
+
+	ADC0CN2 = 0x00;
+	adc_profile = 0xFF;
+	Adc_Profile(ADC_AMPL);
+}
+
+// Switch acquisition profile; no-op if already selected.  The ADC is
+// disabled while it is reconfigured and the first conversion after is
+// thrown away, so the track/hold and reference have settled for the
+// caller's first sample.  Not while a window run owns the ADC.
+void Adc_Profile (unsigned char p)
+{
+	adc_prof code *a = &adc_profiles[p];
+	unsigned char held;
+
+	if (p == adc_profile) return;
+	ADC_HOLD(held);
+	adc_profile = p;
+	ADEN = 0;
+	ADBMEN  = a->burst;
+	ADC0CN1 = a->cn1;
+	ADC0CF1 = a->cf1;
+	adc_full = a->full;
+	ADEN = 1;
+	ADC_at_Pin(ADC0MX);
+	ADC_RELEASE(held);
+}
+
+void InitPinADC (unsigned char portno, unsigned char pinno)
+{
+	unsigned char mask = 1 << pinno;
+	SFRPAGE = 0x20;
+	switch (portno)
+	{
+		case 0: P0MDIN &= (~mask); P0SKIP |= mask; break;
+		case 1: P1MDIN &= (~mask); P1SKIP |= mask; break;
+		case 2: P2MDIN &= (~mask); P2SKIP |= mask; break;
+		default: break;
+	}
+	SFRPAGE = 0x00;
+}
+
+unsigned int ADC_at_Pin (unsigned char pin)
+{
+	unsigned char held;
+	unsigned int x;
+
+	ADC_HOLD(held);
+	ADC0MX = pin;
+	ADINT  = 0;
+	ADBUSY = 1;
+	while (!ADINT);
+	x = ADC0;
+	ADC_RELEASE(held);
+	return x;
+}
+
+float Volts_at_Pin (unsigned char pin)
+{
+	return ((ADC_at_Pin(pin) * VDD) / adc_full);
+}
+
+
+// ----------------------------------------------------------------
+// Threshold measurement
+// ----------------------------------------------------------------
+
+// Edge thresholds follow each channel's signal.  Every sample taken while
+// waiting for an edge widens that channel's lo..hi window; at the end of a
+// reading the thresholds move to THR_HYST of the span above and below the
+// midline and the window restarts.  Edges are then found at the same
+// fraction of the waveform on both channels whatever their amplitude or
+// DC offset, and the gap between the two thresholds keeps noise from
+// re-triggering.  The fixed THRESH1/THRESH2 only seed the first reading.
+meas_chan meas_ch1 = { CH1, THRESH1, THRESH1/2, VDD, 0, 0, -1, 0 };
+meas_chan meas_ch2 = { CH2, THRESH2, THRESH2/2, VDD, 0, 0, -1, 0 };
+
+// Every wait below is bounded by meas_limit timebase ticks (SYSCLK/12, see
+// Ticks() in timebase.c): 1.5 periods of the last good reading.
+// A channel that misses its deadline reads as "No signal".  Until both are
+// back, readings come from Measure_Both(), which catches the missing one
+// at its first edge.  A reading that saw no edge at all grows the limit 4x
+// up to MEAS_MAX_TICKS, so a slower signal is picked up again.
+unsigned long meas_limit = MEAS_MAX_TICKS;
+unsigned long meas_deadline;
+unsigned char overflow0, overflow2; // Timer0/Timer2 overflows, counted by Wait_Level()
+bit meas_both;                      // The last reading saw both channels
+bit meas_seen;                      // Measure_Both() timed an edge this reading
+
+// Samples a few microseconds apart differ by little more than the noise,
+// so each wait loop starts with c->last = -1 and the steps it sees measure
+// the noise for Track_Update()
+float Sample (meas_chan *c)
+{
+	float v = Volts_at_Pin(c->pin);
+	if (v < c->lo) c->lo = v;
+	if (v > c->hi) c->hi = v;
+	if (c->last >= 0 && fabs(v - c->last) > c->step) c->step = fabs(v - c->last);
+	c->last = v;
+	return v;
+}
+
+// Widen the window with a captured block: whole cycles of both channels,
+// where the edge waits may only have seen part of CH2's valley
+void Track_Block (meas_chan *c, xdata int *x)
+{
+	unsigned int i;
+	int lo = x[0], hi = x[0];
+
+	for (i = 1; i < GZ_N; i++)
+	{
+		if (x[i] < lo) lo = x[i];
+		if (x[i] > hi) hi = x[i];
+	}
+	if ((lo * VDD) / ADC_FULL < c->lo) c->lo = (lo * VDD) / ADC_FULL;
+	if ((hi * VDD) / ADC_FULL > c->hi) c->hi = (hi * VDD) / ADC_FULL;
+}
+
+// New thresholds from the samples seen since the last call.  A flat or
+// noise-only input (a probe off) keeps the ones it had, so the signal that
+// comes back is timed at the same fraction of its hump as before.
+void Track_Update (meas_chan *c)
+{
+	float span;
+
+	if (c->hi < c->lo) return; // Not sampled
+	c->peak = c->hi;
+	span = c->hi - c->lo;
+	if (span >= THR_MIN_SPAN && span >= THR_NOISE * c->step)
+	{
+		c->rise = c->lo + (0.5 + THR_HYST) * span;
+		c->fall = c->lo + (0.5 - THR_HYST) * span;
+	}
+	c->lo = VDD;
+	c->hi = 0;
+	c->step = 0;
+}
+
+// Sample until the channel is at or above its rising threshold (rise = 1)
+// or at or below its falling one (rise = 0), keeping the largest sample in
+// *vmax if vmax is not NULL.  Returns 0 if meas_limit ticks pass first.
+bit Wait_Level (meas_chan *c, bit rise, float *vmax)
+{
+	float v;
+
+	Adc_Profile(vmax != NULL ? meas_block : meas_edge);
+	meas_deadline = Ticks() + meas_limit;
+	c->last = -1;
+	while (1)
+	{
+		v = Sample(c);
+		if (vmax != NULL && v > *vmax) *vmax = v;
+		if (rise ? (v >= c->rise) : (v <= c->fall)) return 1;
+		if (TF0)  { TF0 = 0;  overflow0++; }
+		if (TF2H) { TF2H = 0; overflow2++; }
+		if ((long)(Ticks() - meas_deadline) >= 0) return 0;
+	}
+}
+
+// SYSCLK/12 ticks of the stopped Timer2 plus its overflows
+unsigned long Timer2_Ticks (void)
+{
+	unsigned int tmr2_val;
+
+	if (TF2H) { TF2H = 0; overflow2++; } // Landed after the last poll
+	tmr2_val = ((unsigned int)TMR2H << 8) | (unsigned int)TMR2L;
+	return (unsigned long)overflow2 * 65536UL + (unsigned long)tmr2_val;
+}
+
+// Peaks, CH1 period and CH1 -> CH2 phase from threshold crossings.
+// m->status tells which channels were seen; if CH1 is missing the period
+// comes from CH2 alone.  After a reading that missed a channel this is
+// Measure_Both().
+void Measure_Phase (meas_result *m)
+{
+	float v1, v2;
+	unsigned long dt_ticks;
+
+	if (!meas_both)
+	{
+		Measure_Both(m);
+		return;
+	}
+
+	m->status = 0;
+	m->v1max = m->v2max = 0;
+	m->phase = 0;
+
+	/***************************************************************
+	 * STEP 1: Synchronize — wait for both signals in their valleys
+	 *
+	 * Near +/-180 deg the common valley is only the threshold
+	 * slivers; if it is not found in time settle for CH1's valley.
+	 ***************************************************************/
+	Adc_Profile(meas_edge);
+	meas_deadline = Ticks() + meas_limit;
+	meas_ch1.last = meas_ch2.last = -1;
+	while (1)
+	{
+		v1 = Sample(&meas_ch1); // Both every time, for the trackers
+		v2 = Sample(&meas_ch2);
+		if (v1 <= meas_ch1.fall && v2 <= meas_ch2.fall) break;
+		if ((long)(Ticks() - meas_deadline) >= 0)
+		{
+			Wait_Level(&meas_ch1, 0, NULL);
+			break;
+		}
+	}
+
+	/***************************************************************
+	 * STEP 2: Time one CH1 period -> get T0, and collect CH1 peak
+	 *
+	 * Rising edge to rising edge at the same threshold, so the
+	 * threshold height cancels out of the period. Timer0 overflows
+	 * are counted, so periods over ~10.9ms still time right.
+	 * ET0 disabled so ISR can't reset TMR0 mid-measurement.
+	 ***************************************************************/
+	if (Wait_Level(&meas_ch1, 1, NULL))           // wait for CH1 rising edge
+	{
+		ET0 = 0;
+		TR0 = 0; TMR0 = 0; TF0 = 0;
+		overflow0 = 0;
+		TR0 = 1;
+
+		if (Wait_Level(&meas_ch1, 0, &m->v1max) &&  // ride the hump
+		    Wait_Level(&meas_ch1, 1, NULL))         // wait for CH1 next rising edge
+			m->status |= MEAS_CH1;
+		TR0 = 0;
+		// CH1 just rose — this exact moment is the start of the phase measurement
+
+		if (TF0) { TF0 = 0; overflow0++; }
+		m->period_ticks = (unsigned long)overflow0 * 65536UL + TMR0;
+		if (m->period_ticks < MEAS_MIN_PERIOD) m->status = 0;
+	}
+
+	if (!(m->status & MEAS_CH1))
+	{
+		// No CH1: keep measuring CH2 on its own
+		m->v1max = 0;
+		m->period_ticks = Measure_Full_Period(&meas_ch2, &m->v2max);
+		if (m->period_ticks >= MEAS_MIN_PERIOD) m->status |= MEAS_CH2;
+		else m->v2max = 0;
+	}
+	else
+	{
+		/***************************************************************
+		 * STEP 3 & 4: Measure phase
+		 *
+		 * Timer2 starts NOW at CH1's rising edge.
+		 * We wait for CH2 to rise and stop Timer2.
+		 * delta_t = time from CH1 rise to CH2 rise.
+		 *
+		 * Overflow counter handles cases where CH2 lags CH1 by more
+		 * than ~10.9ms (Timer2's 16-bit limit at 6MHz).
+		 *
+		 * Sign convention:
+		 *   delta_t small  -> CH1 leads CH2 -> phase POSITIVE
+		 *   delta_t large  -> CH1 lags  CH2 -> phase NEGATIVE
+		 *                     (detected by normalizing > 180 -> -= 360)
+		 ***************************************************************/
+		TMR2H = 0;
+		TMR2L = 0;
+		TF2H  = 0;
+		overflow2 = 0;
+		TR2 = 1;  // START phase timer at CH1 rising edge
+
+		// If CH1 lags CH2, CH2 is already mid-hump when CH1 rises.
+		// Wait for CH2 current hump to END first, then catch the next
+		// rising edge. This gives the correct negative delta_t.
+		// If CH1 leads CH2, CH2 is still in valley so the first wait
+		// returns at once — no extra delay, works correctly either way.
+		if (Wait_Level(&meas_ch2, 0, NULL) &&      // skip current hump if mid-hump
+		    Wait_Level(&meas_ch2, 1, NULL))        // wait for next rising edge
+		{
+			TR2 = 0;  // STOP at CH2 rising edge
+			dt_ticks = Timer2_Ticks();
+
+			m->phase = ((float)dt_ticks / (float)m->period_ticks) * 360.0;
+
+			// Normalize to -180 to +180
+			// > 180 means CH1 appears to "lead" by a lot but actually lags
+			if (m->phase > 180.0)  m->phase -= 360.0;
+			if (m->phase < -180.0) m->phase += 360.0;
+
+			/***************************************************************
+			 * STEP 5: Collect CH2 peak
+			 *
+			 * We're sitting right at CH2's rising edge from step 4.
+			 * Just ride the hump to get v2max — no extra sync needed.
+			 ***************************************************************/
+			if (Wait_Level(&meas_ch2, 0, &m->v2max)) m->status |= MEAS_CH2;
+		}
+		TR2 = 0;
+		if (!(m->status & MEAS_CH2))
+		{
+			m->v2max = 0;
+			m->phase = 0;
+		}
+	}
+
+	Finish_Reading(m);
+}
+
+// Thresholds, T0/f0 and the next deadline once m->status and
+// m->period_ticks are known
+void Finish_Reading (meas_result *m)
+{
+	Track_Update(&meas_ch1);
+	Track_Update(&meas_ch2);
+
+	if (m->status)
+	{
+		m->T0 = (float)m->period_ticks * ((float)12 / SYSCLK);
+		m->f0 = 1.0 / m->T0;
+		meas_limit = m->period_ticks + m->period_ticks / 2;
+		if (meas_limit < MEAS_MIN_TICKS) meas_limit = MEAS_MIN_TICKS;
+	}
+	else
+	{
+		m->period_ticks = 0;
+		m->T0 = m->f0 = 0;
+		// Not once edges are coming: Measure_Both() gives each one
+		// meas_limit from the one before
+		if (!meas_seen)
+			meas_limit = (meas_limit < MEAS_MAX_TICKS / 4) ? 4 * meas_limit : MEAS_MAX_TICKS;
+	}
+	meas_both = (m->status == (MEAS_CH1 | MEAS_CH2));
+	meas_seen = 0;
+}
+
+// Measure_Both(): where one channel's edges are
+#define EDGE_WAIT  0  // For the valley
+#define EDGE_ARMED 1  // In the valley
+#define EDGE_BAND  2  // Between the thresholds, coming up
+#define EDGE_HUMP  3  // Rose from the band, timed
+
+typedef struct
+{
+	unsigned char state;  // EDGE_...
+	unsigned char rises;  // Timed rising edges, up to 2
+	unsigned char humps;  // Humps ridden after a timed edge, up to 1
+	unsigned long t0, t1; // Ticks() of the last two rising edges
+} meas_edges;
+
+// One sample of c taken at Ticks() 'now'.  A jump from the valley to
+// above the rising threshold is a signal coming back mid-hump, not an
+// edge, so only rises through the band are timed.  Returns 1 on a timed
+// edge or the end of its hump.
+bit Edge_Step (meas_chan *c, meas_edges *e, unsigned long now)
+{
+	float v = Sample(c);
+
+	switch (e->state)
+	{
+		case EDGE_WAIT:
+			if (v <= c->fall) e->state = EDGE_ARMED;
+			break;
+		case EDGE_ARMED:
+			if (v >= c->rise) e->state = EDGE_WAIT;
+			else if (v > c->fall) e->state = EDGE_BAND;
+			break;
+		case EDGE_BAND:
+			if (v <= c->fall) e->state = EDGE_ARMED;
+			else if (v >= c->rise)
+			{
+				e->t0 = e->t1;
+				e->t1 = now;
+				if (e->rises < 2) e->rises++;
+				e->state = EDGE_HUMP;
+				return 1;
+			}
+			break;
+		default:
+			if (v <= c->fall)
+			{
+				e->humps = 1;
+				e->state = EDGE_ARMED;
+				return 1;
+			}
+			break;
+	}
+	return 0;
+}
+
+// Both channels sampled in turn in one loop, for the readings after one
+// went missing: whichever comes back is timed from its first edge, while
+// the other keeps being measured.  The reading ends once both have shown
+// a timed edge and a hump and either has shown a period, about a period
+// after the first edge of a returning signal.  The period is CH1's if it
+// has one, else CH2's (they are the same frequency).  A channel that still
+// needs an edge gets meas_limit from the last one it showed, so a missing
+// one costs meas_limit after the other is done, and a slow one is followed
+// edge to edge.  Edges are one loop (two conversions) coarse; peaks are
+// the largest samples of the reading.
+void Measure_Both (meas_result *m)
+{
+	meas_edges e1, e2;
+	unsigned long now;
+	bit ev1, ev2;
+
+	e1.state = e2.state = EDGE_WAIT;
+	e1.rises = e2.rises = 0;
+	e1.humps = e2.humps = 0;
+	e1.t1 = e2.t1 = 0;
+
+	Adc_Profile(meas_edge);
+	meas_deadline = Ticks() + meas_limit;
+	meas_ch1.last = meas_ch2.last = -1;
+	while (1)
+	{
+		now = Ticks();
+		// A channel is done with a hump and, if CH1 has no period, a
+		// period of its own
+		ev1 = Edge_Step(&meas_ch1, &e1, now) && !(e1.humps && e1.rises == 2);
+		ev2 = Edge_Step(&meas_ch2, &e2, now) &&
+		      !(e2.humps && (e2.rises == 2 || e1.rises == 2));
+		if (ev1 || ev2)
+		{
+			meas_seen = 1;
+			meas_deadline = now + meas_limit;
+		}
+		if (e1.humps && e2.humps && (e1.rises == 2 || e2.rises == 2)) break;
+		if ((long)(now - meas_deadline) >= 0) break;
+	}
+
+	m->status = 0;
+	m->v1max = m->v2max = 0;
+	m->phase = 0;
+	m->period_ticks = 0;
+	if (e1.humps && e1.rises == 2 && e1.t1 - e1.t0 >= MEAS_MIN_PERIOD)
+	{
+		m->status = MEAS_CH1;
+		m->period_ticks = e1.t1 - e1.t0;
+	}
+	if (e2.humps && e2.rises == 2 && e2.t1 - e2.t0 >= MEAS_MIN_PERIOD)
+	{
+		if (!(m->status & MEAS_CH1)) m->period_ticks = e2.t1 - e2.t0;
+		m->status |= MEAS_CH2;
+	}
+	if (m->status && e1.humps && e2.humps)
+		m->status = MEAS_CH1 | MEAS_CH2; // The period from either
+	if (m->status & MEAS_CH1) m->v1max = meas_ch1.hi;
+	if (m->status & MEAS_CH2) m->v2max = meas_ch2.hi;
+	if (m->status == (MEAS_CH1 | MEAS_CH2))
+	{
+		// Any CH2 edge against any CH1 edge, a whole number of periods out
+		m->phase = ((float)(long)(e2.t1 - e1.t1) / (float)m->period_ticks) * 360.0;
+		while (m->phase > 180.0)  m->phase -= 360.0;
+		while (m->phase < -180.0) m->phase += 360.0;
+	}
+	Finish_Reading(m);
+}
+
+// Rising edge -> next rising edge on one channel, in SYSCLK/12 ticks:
+// the single-pass full period method of v_f_lcd.c and lab5_ver1.c.
+// Sine-arch clipping at the threshold cancels on both edges.
+// Returns 0 if an edge does not come within meas_limit.
+unsigned long Measure_Full_Period (meas_chan *c, float *vmax)
+{
+	bit ok;
+
+	*vmax = 0;
+
+	// Make sure we start from a valley, then wait for FIRST rising edge
+	if (!Wait_Level(c, 0, NULL) || !Wait_Level(c, 1, NULL))
+		return 0;
+
+	// Start Timer2 at the rising edge
+	TMR2H = 0;
+	TMR2L = 0;
+	TF2H  = 0;
+	overflow2 = 0;
+	TR2 = 1;
+
+	// Ride the hump, collect peak, then wait through the valley,
+	// counting overflows; stop at the NEXT rising edge — exactly one
+	// full period elapsed
+	ok = Wait_Level(c, 0, vmax) && Wait_Level(c, 1, NULL);
+	TR2 = 0;
+
+	return ok ? Timer2_Ticks() : 0;
+}
+
+
+// ----------------------------------------------------------------
+// Window-comparator edge timing
+// ----------------------------------------------------------------
+
+// Timer2 overflows start the conversions (ADC0CN2.ADCM) every
+// WIN_INTERVAL ticks and the window comparator raises ADWINT only when a
+// result is past the threshold being waited for.  The ISR below stamps it
+// with the timebase count and moves the window on, so the whole CH1 period and
+// CH1 -> CH2 delay are timed without the CPU: Window_Start() arms a run,
+// the main loop does its reports and math, and Measure_Window() collects.
+//
+// Window semantics (ADC0LT < ADC0GT: ADC0 < ADC0LT or ADC0 > ADC0GT):
+//   at or above 'rise': GT = rise - 1, LT = 0
+//   at or below 'fall': GT = 0xFFFF,   LT = fall + 1
+//   any result:        GT = 0x4001,   LT = 0x4000
+#define WIN_ABOVE(c) { ADC0LT = 0; ADC0GT = (c) - 1; }
+#define WIN_BELOW(c) { ADC0GT = 0xFFFF; ADC0LT = (c) + 1; }
+#define WIN_ANY()    { ADC0GT = 0x4001; ADC0LT = 0x4000; }
+
+// The end of a run, from the ISR as soon as it is done or from
+// Window_Stop(): software-started conversions again, so Timer4_ISR()
+// (pq.c) no longer stops Timer2 for its pairs
+#define WIN_END() \
+{ \
+	EIE1 &= ~EWADC0; \
+	TR2 = 0; \
+	while (ADBUSY);  /* Let a triggered conversion finish */ \
+	ADC0CN2 = ADCM_ADBUSY; \
+	ADWINT  = 0; \
+	TMR2RL  = 0x0000; \
+}
+
+// win_state: what the window is armed for
+#define WIN_IDLE       0
+#define WIN_CH1_VALLEY 1  // CH1 at or below fall
+#define WIN_CH1_EDGE   2  // CH1 rise -> win_t0
+#define WIN_CH1_HUMP   3  // CH1 fall
+#define WIN_CH1_NEXT   4  // CH1 rise -> win_t1, mux to CH2
+#define WIN_CH2_SKIP   5  // The conversion in flight may still be CH1
+#define WIN_CH2_VALLEY 6  // CH2 fall
+#define WIN_CH2_EDGE   7  // CH2 rise -> win_t2
+#define WIN_DONE       8
+
+volatile unsigned char win_state = WIN_IDLE;
+// Rising edges, CH1, CH1 again, CH2: TB_READ() pairs, made Ticks() by
+// Win_Ticks() outside the ISR
+unsigned long win_ms[3];
+unsigned int  win_n[3];
+unsigned int  win_rise1, win_fall1, win_rise2, win_fall2; // ADC codes
+
+// Threshold in volts -> ADC code the window macros can use
+unsigned int Win_Code (float v)
+{
+	float c = v * adc_full / VDD;
+
+	if (c < 2) return 2;
+	if (c > adc_full - 1) return adc_full - 1;
+	return (unsigned int)c;
+}
+
+// Runs at the end of the conversion that crossed the threshold
+void ADC0_WC_ISR (void) interrupt INTERRUPT_ADC0_WC
+{
+	unsigned long ms;
+	unsigned int n;
+
+	SFRPAGE = 0x0;
+	ADWINT = 0;
+	TB_READ(ms, n);
+
+	switch (win_state)
+	{
+		case WIN_CH1_VALLEY:
+			WIN_ABOVE(win_rise1);
+			win_state = WIN_CH1_EDGE;
+			break;
+		case WIN_CH1_EDGE:
+			win_ms[0] = ms;
+			win_n[0] = n;
+			WIN_BELOW(win_fall1);
+			win_state = WIN_CH1_HUMP;
+			break;
+		case WIN_CH1_HUMP:
+			WIN_ABOVE(win_rise1);
+			win_state = WIN_CH1_NEXT;
+			break;
+		case WIN_CH1_NEXT:
+			win_ms[1] = ms;
+			win_n[1] = n;
+			ADC0MX = CH2;
+			WIN_ANY();
+			win_state = WIN_CH2_SKIP;
+			break;
+		case WIN_CH2_SKIP:
+			WIN_BELOW(win_fall2);
+			win_state = WIN_CH2_VALLEY;
+			break;
+		case WIN_CH2_VALLEY:
+			WIN_ABOVE(win_rise2);
+			win_state = WIN_CH2_EDGE;
+			break;
+		case WIN_CH2_EDGE:
+			win_ms[2] = ms;
+			win_n[2] = n;
+			WIN_END();
+			win_state = WIN_DONE;
+			break;
+		default:
+			WIN_END();
+			break;
+	}
+}
+
+// Arm a run with the current thresholds.  Timer2 and the ADC belong to
+// it until Measure_Window() or Window_Stop().
+void Window_Start (void)
+{
+	Adc_Profile(meas_edge);
+	win_rise1 = Win_Code(meas_ch1.rise);
+	win_fall1 = Win_Code(meas_ch1.fall);
+	win_rise2 = Win_Code(meas_ch2.rise);
+	win_fall2 = Win_Code(meas_ch2.fall);
+
+	TR2 = 0;
+	TMR2RL = -WIN_INTERVAL;
+	TMR2   = TMR2RL;
+	TF2H   = 0;
+	ADC0MX = CH1;
+	WIN_BELOW(win_fall1);
+	win_state = WIN_CH1_VALLEY;
+	ADWINT  = 0;
+	EIE1   |= EWADC0;  // First: Timer4_ISR() tells a run from a scope capture by it
+	ADC0CN2 = ADCM_TIMER2;
+	TR2 = 1;
+}
+
+unsigned long Win_Ticks (unsigned char i)
+{
+	return win_ms[i] * TB_TICKS_PER_MS + win_n[i];
+}
+
+// Back to software-started conversions and a free-running Timer2
+void Window_Stop (void)
+{
+	WIN_END();
+	win_state = WIN_IDLE;
+}
+
+// Measure_Phase() results from a window run.  Each step of the run gets
+// meas_limit ticks from when it is first seen here, so a missing channel
+// reads as "No signal" just like in Measure_Phase().  Peaks are the
+// tracker's: the largest samples of the last captured block.  Without a
+// run armed (first reading, or no block capture) this is Measure_Phase(),
+// and a run that lost CH1 ends in Measure_Both().
+void Measure_Window (meas_result *m)
+{
+	unsigned char seen = WIN_IDLE, state;
+
+	if (win_state == WIN_IDLE)
+	{
+		Measure_Phase(m);
+		return;
+	}
+
+	while ((state = win_state) != WIN_DONE)
+	{
+		if (state != seen)
+		{
+			seen = state;
+			meas_deadline = Ticks() + meas_limit;
+		}
+		else if ((long)(Ticks() - meas_deadline) >= 0) break;
+	}
+	Window_Stop();
+
+	m->status = 0;
+	m->v1max = m->v2max = 0;
+	m->phase = 0;
+	m->period_ticks = 0;
+	if (state >= WIN_CH2_SKIP)
+	{
+		m->period_ticks = Win_Ticks(1) - Win_Ticks(0);
+		if (m->period_ticks >= MEAS_MIN_PERIOD) m->status = MEAS_CH1;
+	}
+
+	if (!(m->status & MEAS_CH1))
+	{
+		// No CH1: poll for both, like the readings that follow
+		Measure_Both(m);
+		return;
+	}
+
+	if (state == WIN_DONE)
+	{
+		m->phase = ((float)(Win_Ticks(2) - Win_Ticks(1)) / (float)m->period_ticks) * 360.0;
+		if (m->phase > 180.0)  m->phase -= 360.0;
+		if (m->phase < -180.0) m->phase += 360.0;
+		m->status |= MEAS_CH2;
+	}
+	Finish_Reading(m);
+	m->v1max = meas_ch1.peak;
+	if (m->status & MEAS_CH2) m->v2max = meas_ch2.peak;
+}
+
+// ----------------------------------------------------------------
+// Goertzel block capture
+// ----------------------------------------------------------------
+
+// Whether Capture_Block() can sample this period with meas_block and
+// scan_n inputs per slot
+bit Block_Fits (unsigned long period_ticks)
+{
+	return period_ticks / GZ_SPC >= (unsigned long)adc_profiles[meas_block].pair * scan_n / 2 &&
+	       period_ticks / GZ_SPC <= GZ_MAX_INTERVAL;
+}
+
+// Sample GZ_N slots with Timer2 in auto-reload so that exactly GZ_SPC
+// slots land in each period: the period_ticks % GZ_SPC ticks left over
+// by the division are spread over the slots one at a time, so every run
+// of GZ_SPC slots spans period_ticks to the tick and the block holds
+// whole cycles, not whole cycles less up to GZ_SPC - 1 ticks each.  A
+// slot is a CH1/CH2 pair, followed by CH3 .. CH5 when scan_n asks for
+// them: every input of a slot shares the period, so one block times them
+// all without syncing to each in turn.
+// Returns how many Timer2 ticks after CH1 the CH2 sample is taken, so the
+// caller can correct the phase; scan_skew[] has it for every input.
+// Results are 14-bit scale (ADC_FULL) in every block profile.
+unsigned int Capture_Block (unsigned long period_ticks)
+{
+	unsigned int i, t1, t2;
+	unsigned char k, held;
+	unsigned int interval = period_ticks / GZ_SPC;
+	unsigned char rem = period_ticks % GZ_SPC, acc = 0;
+	unsigned int guard = 0x10000UL - adc_profiles[meas_block].guard;  // TMR2 from which to hold
+
+	Adc_Profile(meas_block);
+	TR2 = 0;
+	TMR2RL = -interval;
+	TMR2   = TMR2RL;
+	TF2H   = 0;
+	TR2    = 1;
+
+	for (i = 0; i < GZ_N; i++)
+	{
+		while (!TF2H && TMR2 < guard);
+		ADC_HOLD(held);
+		while (!TF2H);
+		TF2H = 0;
+		acc += rem; // Reload for the slot after this one
+		if (acc >= GZ_SPC)
+		{
+			acc -= GZ_SPC;
+			TMR2RL = -(interval + 1);
+		}
+		else TMR2RL = -interval;
+		gz_buf1[i] = ADC_at_Pin(CH1);
+		t1 = TMR2;
+		gz_buf2[i] = ADC_at_Pin(CH2);
+		t2 = TMR2;
+		for (k = 2; k < scan_n; k++)
+		{
+			scan_buf[k][i] = ADC_at_Pin(scan_pin[k]);
+			scan_skew[k] = TMR2 - t1;
+		}
+		ADC_RELEASE(held);
+	}
+	scan_skew[0] = 0;
+	scan_skew[1] = t2 - t1;
+
+	TR2 = 0;
+	TMR2RL = 0x0000; // Back to free-running for the phase timer
+
+	Track_Block(&meas_ch1, gz_buf1);
+	Track_Block(&meas_ch2, gz_buf2);
+	return t2 - t1;
+}
+
+
+// ----------------------------------------------------------------
+// Frequency lock
+// ----------------------------------------------------------------
+
+// The period a reading times from threshold edges jitters by the polling
+// loop, about 0.3% at 1 kHz, and a block sampled with it is not quite
+// whole cycles.  Locked, the period comes from the blocks instead: with
+// the period off by e, the fundamental's phase moves by pi * GZ_CYCLES * e
+// between the first and second half of a block.  Each block corrects the
+// tracked period by LOCK_GAIN of what that shift says, and a reading that
+// differs from it by more than 1/LOCK_SPAN (the input has moved) re-locks
+// it to the reading.
+#define LOCK_GAIN 0.5
+#define LOCK_SPAN 32
+
+gz_coef lock_coef;   // Fundamental of half a block
+float lock_period;   // SYSCLK/12 ticks, 0 = not locked
+
+void Lock_Reset (void)
+{
+	gz_setup(&lock_coef, GZ_CYCLES / 2, GZ_N / 2);
+	lock_period = 0;
+}
+
+// Period for Capture_Block(): the tracked one, or the reading's
+unsigned long Lock_Period (unsigned long measured)
+{
+	if (lock_period == 0 || fabs(measured - lock_period) > lock_period / LOCK_SPAN)
+		lock_period = measured;
+	return (unsigned long)(lock_period + 0.5);
+}
+
+// After Capture_Block(period_ticks): correct the tracked period from the
+// block of the input the reading timed.  Returns the new period.
+float Lock_Update (xdata int *x, unsigned long period_ticks)
+{
+	gz_bin a, b;
+	float dphi;
+
+	gz_run(&a, &lock_coef, x, GZ_N / 2, gz_mean(x, GZ_N / 2));
+	gz_run(&b, &lock_coef, x + GZ_N / 2, GZ_N / 2, gz_mean(x + GZ_N / 2, GZ_N / 2));
+	dphi = atan2((float)b.im * a.re - (float)b.re * a.im,
+	             (float)b.re * a.re + (float)b.im * a.im);
+	lock_period += LOCK_GAIN * (period_ticks / (1.0 + dphi / (PI * GZ_CYCLES)) - lock_period);
+	return lock_period;
+}
+
+
+// ----------------------------------------------------------------
+// Triggered capture (scope mode)
+// ----------------------------------------------------------------
+
+// Shortest Capture_Triggered() interval with the block profile
+unsigned int Scope_Min_Interval (void)
+{
+	return adc_profiles[meas_block].pair;
+}
+
+// Fill the scope ring so that s->pre pairs come before the trigger pair
+// and the rest of the SCOPE_N after it.  Timer2 overflows every
+// interval / 2 start the conversions, CH1 and CH2 in turn; the loop only
+// collects each result and moves the mux before the next overflow.
+// Once the pre-trigger pairs are in, the trigger is armed by the input
+// being SCOPE_HYST codes on the far side of the level, so noise around
+// the level cannot fire it on the wrong slope.  If no edge comes within meas_limit ticks of the
+// pre-trigger part being filled, the block ends there anyway (a scope's
+// auto mode) and s->forced is set.  The ring goes on from where the last
+// block left it; s->start is the oldest pair.
+void Capture_Triggered (scope_trig *s)
+{
+	unsigned int i = scope_next, n = 0, left = 0;
+	unsigned long wait = meas_limit / s->interval + 1;
+	int level = s->level;
+	int arm = s->falling ? level + SCOPE_HYST : level - SCOPE_HYST;
+	int v1, v2, v;
+	bit armed = 0, fired = 0;
+
+	s->forced = 0;
+	Adc_Profile(meas_block);
+	// A pair for Timer4_ISR() (pq.c) until the first one of the capture
+	// is in; the ring is filled whole after it
+	scope_buf1[i] = ADC_at_Pin(CH1);
+	scope_buf2[i] = ADC_at_Pin(CH2);
+	i = (i + 1) & (SCOPE_N - 1);
+	scope_next = i;
+	TR2 = 0;
+	TMR2RL = -(s->interval / 2);
+	TMR2   = TMR2RL;
+	TF2H   = 0;
+	ADC0MX = CH1;
+	ADINT  = 0;
+	ADC0CN2 = ADCM_TIMER2;
+	TR2 = 1;
+
+	while (1)
+	{
+		while (!ADINT);
+		ADINT = 0;
+		ADC0MX = CH2;
+		v1 = ADC0;
+		while (!ADINT);
+		ADINT = 0;
+		ADC0MX = CH1;
+		v2 = ADC0;
+		scope_buf1[i] = v1;
+		scope_buf2[i] = v2;
+		i = (i + 1) & (SCOPE_N - 1);
+		scope_next = i;
+
+		if (fired)
+		{
+			if (--left == 0) break;
+			continue;
+		}
+		if (n < s->pre)
+		{
+			n++;
+			continue;
+		}
+		v = (s->pin == CH1) ? v1 : v2;
+		if (armed && (s->falling ? v <= level : v >= level)) fired = 1;
+		else if (--wait == 0) { fired = 1; s->forced = 1; }
+		else if (s->falling ? v > arm : v < arm) armed = 1;
+		if (fired && (left = SCOPE_N - 1 - s->pre) == 0) break;
+	}
+
+	TR2 = 0;
+	while (ADBUSY);
+	ADC0CN2 = ADCM_ADBUSY;
+	TMR2RL  = 0x0000;
+	s->start = i;
+}
@@ -0,0 +1,164 @@
+// measure.h:  ADC access and the threshold measurement loop of the AC meter
+//
+// Everything in here touches the hardware only through SFRs, so the same
+// source also builds on Linux against the simulated ADC and timers in
+// host/sim (see host/bench_measure.c).
+
+#ifndef MEASURE_H
+#define MEASURE_H
+
+#define SYSCLK 72000000L
+#define SARCLK 18000000L
+
+#define CH1 QFP32_MUX_P2_1  // ADC input on P2.1
+#define CH2 QFP32_MUX_P2_2  // ADC input on P2.2 (REFERENCE signal)
+#define CH3 QFP32_MUX_P2_3  // Extra inputs, sampled by Capture_Block() when
+#define CH4 QFP32_MUX_P2_4  // scan_n > 2 (multi-channel mode, multi.c)
+#define CH5 QFP32_MUX_P2_5
+#define SCAN_MAX 5          // Inputs per Capture_Block() slot, CH1 .. CH5
+
+#define THRESH1 0.05  // CH1 starting threshold (large ~2.1V peak)
+#define THRESH2 0.02  // CH2 starting threshold (smaller ~0.77V peak)
+
+// Adaptive thresholds: midline +/- THR_HYST of each channel's tracked span
+#define THR_HYST     0.20  // Rising edge at 70% of the span, falling at 30%
+#define THR_MIN_SPAN 0.001 // Volts, 5 LSBs; a flatter input is treated as noise
+#define THR_NOISE    2     // So is a span under this many times the largest
+                           // step between consecutive samples
+#define VDD 3.3
+#define ADC_FULL 0x3FFF // 14-bit full scale
+
+// ADC acquisition profiles for Adc_Profile().  Conversion time is the
+// tracking time plus bits + 2 SARCLK periods at 18 MHz; the rates are the
+// ADC's own, the polled loops add the firmware around each conversion.
+//   ADC_AMPL    14-bit, 0.42us tracking          1.31us   760 ksps
+//   ADC_EDGE12  12-bit, 0.25us tracking          1.03us   970 ksps
+//   ADC_EDGE10  10-bit, 0.25us tracking          0.92us  1090 ksps
+//   ADC_ACC4    4 x ADC_AMPL per start, /4       5.2us    190 ksps
+//   ADC_ACC16   16 x ADC_EDGE12 per start, /4   16.5us     60 ksps
+// ACC4 halves the noise at 14 bits; ACC16 gives 14-bit scale results from
+// 12-bit conversions.  The EDGE profiles shorten tracking as well: the
+// settling error is the same on every edge and cancels in the timing.
+// They pay in threshold resolution, 0.8mV or 3.2mV: for inputs under a
+// few hundred mV keep edges at ADC_AMPL, the default.
+#define ADC_AMPL   0
+#define ADC_EDGE12 1
+#define ADC_EDGE10 2
+#define ADC_ACC4   3
+#define ADC_ACC16  4
+
+// Block capture is paced by Timer2 at period/GZ_SPC, which must leave room
+// for a CH1+CH2 conversion pair and still fit the 16-bit reload: roughly
+// 2.9 Hz to 1 kHz.  Scanning all five inputs takes 2.5 pairs' time, which
+// lowers the top to just under 500 Hz.
+#define GZ_MIN_INTERVAL  150UL     // Timer2 ticks (25us) per pair, see Block_Fits()
+#define GZ_MAX_INTERVAL  65535UL
+
+// ADC0CN2 ADCM: what starts a conversion
+#define ADCM_ADBUSY 0x00  // ADBUSY = 1
+#define ADCM_TIMER2 0x02  // Timer2 overflows
+
+// The power-quality detector (pq.c) converts CH1 and CH2 from the Timer4
+// interrupt, in between the main program's conversions.  A run of them
+// that must not be split (one conversion, a Capture_Block() slot, a new
+// profile) holds that interrupt off; it is taken as soon as the run is
+// over.  Holds nest: each restores what it found.  Capture_Block() also
+// holds it before each slot for as long as the interrupt can run: its
+// own work, ADC_GUARD (a square root at most), and its two conversions in
+// the block's profile, 16 ticks at ADC_AMPL but 198 at ADC_ACC16 (see
+// adc_profiles[] in measure.c).  So it never delays a slot's conversions.
+#define ET4_MASK  0x04  // EIE2: Timer4 interrupt
+#define ADC_GUARD 224   // 37us
+#define ADC_HOLD(s)    ((s) = EIE2 & ET4_MASK, EIE2 &= ~ET4_MASK)
+#define ADC_RELEASE(s) (EIE2 |= (s))
+
+// Window-comparator edge timing (measure.c): conversions started by
+// Timer2 every WIN_INTERVAL ticks, time resolution of the edges
+#define WIN_INTERVAL 12    // 2us: 500 ksps, room for any non-burst profile
+// Timer4_ISR() stops the run's Timer2 for the time of its own pair, so an
+// edge that falls in that gap is timed up to one pair late
+#define EWADC0       0x04  // EIE1: ADC0 window compare interrupt, on during a run
+
+// Bounds on every wait for an edge (see measure.c), SYSCLK/12 ticks
+#define MEAS_MIN_TICKS 12000UL    // 2 ms
+#define MEAS_MAX_TICKS 6000000UL  // 1 s: the slowest signal followed
+#define MEAS_MIN_PERIOD 3000UL    // Shorter "periods" (over 2 kHz) are chatter
+
+// Triggered capture for the scope mode (scope.c): a ring of SCOPE_N
+// CH1/CH2 pairs converted on Timer2 overflows, so the sample instants do
+// not move with the UART interrupt that streams the previous block.  The
+// ring doubles as CH3 .. CH5's blocks, which only the multi-channel mode
+// captures.
+#define SCOPE_N    256  // Pairs per block, power of two (1 KB of XRAM)
+#define SCOPE_HYST 64   // ADC codes past the level that re-arm the trigger
+// While a capture runs, Timer4_ISR() takes the latest pair, the one before
+// scope_buf1/2[scope_next], instead of converting its own
+
+// meas_result.status
+#define MEAS_CH1 0x01  // CH1 seen: v1max and the period are from CH1
+#define MEAS_CH2 0x02  // CH2 seen: v2max valid; phase needs both
+
+typedef struct
+{
+	unsigned char status;        // MEAS_CH1 | MEAS_CH2, 0 = no signal
+	float v1max, v2max;          // Peak volts of the last hump
+	float T0, f0;                // Period (s) and frequency (Hz)
+	float phase;                 // CH1 rise -> CH2 rise, -180..+180 deg
+	unsigned long period_ticks;  // Period in SYSCLK/12 ticks, 0 if unknown
+} meas_result;
+
+typedef struct
+{
+	unsigned char pin;  // ADC mux input
+	float rise, fall;   // Edge thresholds, volts
+	float lo, hi;       // Extremes sampled since the last Track_Update()
+	float peak;         // hi at the last Track_Update()
+	float last;         // Previous sample of this wait, < 0 before the first
+	float step;         // Largest change from 'last' since the last Track_Update()
+} meas_chan;
+
+typedef struct
+{
+	unsigned char pin;       // Trigger input, CH1 or CH2
+	unsigned char falling;   // Trigger on the falling edge, else the rising one
+	unsigned int  level;     // ADC code, 14-bit scale
+	unsigned int  pre;       // Pairs kept before the trigger pair, < SCOPE_N
+	unsigned int  interval;  // Timer2 ticks per pair, even; CH2 is half after CH1
+	unsigned int  start;     // Out: ring index of the oldest pair
+	unsigned char forced;    // Out: no edge within meas_limit, stopped anyway
+} scope_trig;
+
+extern meas_chan meas_ch1, meas_ch2;
+extern unsigned char meas_edge, meas_block;  // ADC_... for edges / amplitude
+extern unsigned int adc_full;                // Full-scale result of the profile in use
+extern xdata int gz_buf1[];
+extern xdata int gz_buf2[];
+extern unsigned char scan_n;
+extern xdata int * code scan_buf[];
+extern unsigned int scan_skew[];
+extern xdata int scope_buf1[];
+extern xdata int scope_buf2[];
+extern volatile unsigned char scope_next;
+
+void  InitADC (void);
+void  Adc_Profile (unsigned char p);
+void  InitPinADC (unsigned char portno, unsigned char pinno);
+unsigned int ADC_at_Pin (unsigned char pin);
+float Volts_at_Pin (unsigned char pin);
+
+void  Measure_Phase (meas_result *m);
+void  Measure_Both (meas_result *m);
+void  Finish_Reading (meas_result *m);
+void  Window_Start (void);
+void  Window_Stop (void);
+void  Measure_Window (meas_result *m);
+unsigned long Measure_Full_Period (meas_chan *c, float *vmax);
+bit   Block_Fits (unsigned long period_ticks);
+unsigned int  Capture_Block (unsigned long period_ticks);
+void  Lock_Reset (void);
+unsigned long Lock_Period (unsigned long measured);
+float Lock_Update (xdata int *x, unsigned long period_ticks);
+unsigned int  Scope_Min_Interval (void);
+void  Capture_Triggered (scope_trig *s);
+
+#endif
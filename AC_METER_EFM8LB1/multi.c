@@ -0,0 +1,144 @@
+// multi.c:  Multi-channel AC monitoring for the AC meter
+//
+// Works on the block Capture_Block() has just taken with scan_n =
+// SCAN_MAX.  The cost is two gz_run() per input (roughly 10 ms for all
+// five at 72 MHz) plus one pass over each block for the crossings.  The
+// averages restart when the period moves by more than 1/16, like the
+// CH1/CH2 average in FULLY_WORKING.c, or when the block changes length.
+
+#include <stdlib.h>
+#include <math.h>
+#include "goertzel.h"
+#include "measure.h"
+#include "multi.h"
+
+#define PEAK_SCALE 2.0  // Half-wave rectified: the fundamental is half the peak
+
+xdata gz_avg multi_avg[SCAN_MAX];  // Each input against the reference
+unsigned long multi_period;        // Period of the averaged blocks, 0 = none
+unsigned char multi_cycles;        // ... and the periods in each
+
+void multi_reset (void)
+{
+	unsigned char k;
+
+	for (k = 0; k < SCAN_MAX; k++) gz_avg_reset(&multi_avg[k]);
+	multi_period = 0;
+}
+
+// Frequency of one input from the crossings of its block's midline,
+// each interpolated between the samples on either side: the rising ones
+// and the falling ones each time whole periods.  The input has to go an
+// eighth of its span past the midline between crossings the same way, so
+// noise on an edge is not counted twice; the first crossing either way
+// is armed from the first sample.  A block of two periods always has two
+// crossings one way or the other.
+float multi_freq (xdata int *x, float interval)
+{
+	unsigned int i;
+	unsigned char k, edges[2];
+	int lo = x[0], hi = x[0], mid, arm;
+	float first[2], last[2], periods = 0, span = 0;
+	bit up, down;
+
+	for (i = 1; i < GZ_N; i++)
+	{
+		if (x[i] < lo) lo = x[i];
+		if (x[i] > hi) hi = x[i];
+	}
+	mid = lo + (hi - lo) / 2;
+	arm = (hi - lo) / 8;
+	up = (x[0] < mid);
+	down = !up;
+	edges[0] = edges[1] = 0;
+
+	for (i = 1; i < GZ_N; i++)
+	{
+		k = 2;
+		if (x[i] < mid - arm) up = 1;
+		else if (up && x[i-1] < mid && x[i] >= mid)
+		{
+			up = 0;
+			k = 0;
+		}
+		if (x[i] > mid + arm) down = 1;
+		else if (down && x[i-1] >= mid && x[i] < mid)
+		{
+			down = 0;
+			k = 1;
+		}
+		if (k == 2) continue;
+		last[k] = (i - 1) + (float)(mid - x[i-1]) / (x[i] - x[i-1]);
+		if (edges[k]++ == 0) first[k] = last[k];
+	}
+	for (k = 0; k < 2; k++)
+		if (edges[k] >= 2)
+		{
+			periods += edges[k] - 1;
+			span += last[k] - first[k];
+		}
+	if (periods == 0) return 0;
+	return periods / (span * interval * ((float)12 / SYSCLK));
+}
+
+// Whether a block of this period is to be MULTI_SLOW_CYCLES periods:
+// under MULTI_SLOW_HZ, or up to 1/16 over it while the blocks already
+// are, so an input right at it does not restart the averages every time
+bit multi_slow (unsigned long period_ticks)
+{
+	unsigned long t = MULTI_SLOW_TICKS;
+
+	if (multi_cycles == MULTI_SLOW_CYCLES) t -= t / 16;
+	return period_ticks > t;
+}
+
+// The block spans 'cycles' periods of period_ticks, GZ_CYCLES or
+// MULTI_SLOW_CYCLES, and c is the coefficient of bin k = cycles
+void multi_analyze (multi_result *r, gz_coef *c, unsigned long period_ticks, unsigned char cycles)
+{
+	unsigned char k;
+	float interval = (float)period_ticks * cycles / GZ_N;  // Slots average this in Capture_Block()
+	float peak;
+	multi_chan *p;
+
+	if (labs((long)(period_ticks - multi_period)) > (long)(multi_period >> 4) ||
+	    cycles != multi_cycles)
+		multi_reset();
+	multi_period = period_ticks;
+	multi_cycles = cycles;
+
+	for (k = 0; k < SCAN_MAX; k++)
+	{
+		p = &r->ch[k];
+		gz_avg_add(&multi_avg[k], c, scan_buf[k], scan_buf[MULTI_REF], GZ_N);
+		peak = PEAK_SCALE * gz_peak(multi_avg[k].p1, GZ_N) * VDD / ADC_FULL;
+		p->ok = (peak >= MULTI_MIN_PEAK);
+		p->vrms = p->ok ? peak / 1.41421356237 : 0;
+		p->f = p->ok ? multi_freq(scan_buf[k], interval) : 0;
+	}
+
+	// Each input is converted scan_skew[] ticks into the slot: one that
+	// comes after the reference would otherwise read as leading it
+	for (k = 0; k < SCAN_MAX; k++)
+	{
+		p = &r->ch[k];
+		p->phase = 0;
+		if (k == MULTI_REF || !p->ok || !r->ch[MULTI_REF].ok) continue;
+		p->phase = gz_phase(&multi_avg[k]) +
+		           (360.0 * ((long)scan_skew[MULTI_REF] - (long)scan_skew[k])) / period_ticks;
+		if (p->phase > 180.0)  p->phase -= 360.0;
+		if (p->phase < -180.0) p->phase += 360.0;
+	}
+}
+
+// Period of the inputs from the block just analysed, SYSCLK/12 ticks:
+// the crossings of the first input that has two, CH1 first like a
+// reading.  0 if none has.
+unsigned long multi_next (multi_result *r)
+{
+	unsigned char k;
+
+	for (k = 0; k < SCAN_MAX; k++)
+		if (r->ch[k].ok && r->ch[k].f > 0) return (unsigned long)(SYSCLK / 12 / r->ch[k].f + 0.5);
+	return 0;
+}
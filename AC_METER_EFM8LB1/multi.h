@@ -0,0 +1,48 @@
+// multi.h:  Multi-channel AC monitoring for the AC meter
+//
+// Capture_Block() (measure.c) with scan_n = SCAN_MAX converts CH1 .. CH5
+// (P2.1 .. P2.5) in every slot of one coherently captured block, so all
+// five inputs are measured from the same GZ_CYCLES periods: three phases
+// and the CH2 reference, plus a spare.  Per input, from that block:
+//
+//   RMS        Goertzel fundamental (goertzel.c), averaged over GZ_AVG
+//              blocks, of the sine before the half-wave rectifier
+//   frequency  rising and falling midline crossings, interpolated between
+//              samples
+//   phase      Goertzel cross spectrum against CH2, corrected for the
+//              input's place in the scan (scan_skew[])
+//
+// Below MULTI_SLOW_HZ (multi_slow()) a block of GZ_CYCLES periods and the
+// reading before it would take over the 1 s a screen may take, so the
+// block is MULTI_SLOW_CYCLES periods of twice the samples instead, and
+// multi_next() gives the period to capture the next one with, without a
+// reading.
+
+#ifndef MULTI_H
+#define MULTI_H
+
+#define MULTI_REF      1     // Index of the reference in the scan: CH2
+#define MULTI_MIN_PEAK 0.02  // Volts; a smaller fundamental is "No signal"
+#define MULTI_SLOW_HZ  10
+#define MULTI_SLOW_TICKS  (SYSCLK / 12 / MULTI_SLOW_HZ)  // Longer periods are slow
+#define MULTI_SLOW_CYCLES (GZ_CYCLES / 2)
+
+typedef struct
+{
+	unsigned char ok;  // Signal present
+	float vrms;        // Volts, of the sine before the rectifier
+	float f;           // Hz, 0 if fewer than two rising crossings
+	float phase;       // Degrees against the reference, (+) when leading
+} multi_chan;
+
+typedef struct
+{
+	multi_chan ch[SCAN_MAX];
+} multi_result;
+
+void multi_reset (void);
+void multi_analyze (multi_result *r, gz_coef *c, unsigned long period_ticks, unsigned char cycles);
+bit  multi_slow (unsigned long period_ticks);
+unsigned long multi_next (multi_result *r);
+
+#endif
@@ -0,0 +1,83 @@
+// power.c:  Real, reactive and apparent power for the AC meter
+//
+// The inputs are half-wave rectified, r(t) = max(s(t), 0).  For a signal
+// with half-wave symmetry s(t) = r(t) - r(t + T/2), and over a block of
+// whole cycles the T/2 shift is just an index offset of GZ_SPC/2 (mod n),
+// so both waveforms are rebuilt sample by sample and the DC cancels.
+//
+// CH2 is converted a couple of microseconds after CH1 in every pair; at
+// 60 Hz that is under 0.05 degrees and is not corrected here.
+
+#include <math.h>
+#include "goertzel.h"
+#include "power.h"
+
+#if (GZ_N > 128)
+	#error pwr_analyze() accumulators are sized for blocks of up to 128 samples
+#endif
+
+// Sample k of the rebuilt (unrectified) waveform
+static int pwr_full (xdata int *x, unsigned int k, unsigned int n)
+{
+	unsigned int j = k + GZ_SPC/2;
+	if (j >= n) j -= n;
+	return x[k] - x[j];
+}
+
+// vscale: line volts per ADC count at CH1, iscale: amps per count at CH2.
+//
+// P = <v*i> from the instantaneous products, S = Vrms*Irms and
+// |Q| = sqrt(S^2 - P^2).  The sign of Q comes from <v(t - T/4)*i(t)>,
+// which for the fundamental is Vrms*Irms*sin(phi).
+void pwr_analyze (pwr_result *r, xdata int *v, xdata int *i, unsigned int n,
+                  float vscale, float iscale)
+{
+	unsigned int k, kq;
+	int vk, ik, vq;
+	long svv = 0, sii = 0, svi = 0, sq = 0;
+	float norm = (float)(1 << PWR_SHIFT) / n;
+
+	for (k = 0; k < n; k++)
+	{
+		kq = (k >= GZ_SPC/4) ? k - GZ_SPC/4 : k + n - GZ_SPC/4;
+		vk = pwr_full(v, k, n);
+		ik = pwr_full(i, k, n);
+		vq = pwr_full(v, kq, n);
+		svv += ((long)vk * vk) >> PWR_SHIFT;
+		sii += ((long)ik * ik) >> PWR_SHIFT;
+		svi += ((long)vk * ik) >> PWR_SHIFT;
+		sq  += ((long)vq * ik) >> PWR_SHIFT;
+	}
+
+	r->vrms = sqrt(svv * norm) * vscale;
+	r->irms = sqrt(sii * norm) * iscale;
+	r->p = svi * norm * vscale * iscale;
+	r->s = r->vrms * r->irms;
+	r->q = r->s * r->s - r->p * r->p;
+	r->q = (r->q > 0) ? sqrt(r->q) : 0;
+	if (sq < 0) r->q = -r->q;
+	r->pf = (r->s > 0) ? r->p / r->s : 0;
+}
+
+void pwr_energy_reset (pwr_energy *e)
+{
+	e->joules = 0;
+	e->frac = 0;
+}
+
+// Whole joules are moved into the long so the float only ever holds the
+// last fraction and small increments are never lost against a big total.
+void pwr_energy_add (pwr_energy *e, float watts, float seconds)
+{
+	long whole;
+
+	e->frac += watts * seconds;
+	whole = (long)e->frac;
+	e->joules += whole;
+	e->frac -= whole;
+}
+
+float pwr_energy_wh (pwr_energy *e)
+{
+	return (e->joules + e->frac) / 3600.0;
+}
@@ -0,0 +1,33 @@
+// power.h:  Real, reactive and apparent power for the AC meter
+//
+// CH1 senses voltage and CH2 current.  pwr_analyze() works on one
+// coherently captured block (GZ_CYCLES whole cycles of GZ_SPC samples, see
+// goertzel.h) of half-wave rectified samples.
+
+#ifndef POWER_H
+#define POWER_H
+
+#define PWR_SHIFT 4  // Products are accumulated >> PWR_SHIFT (n <= 128)
+
+typedef struct
+{
+	float vrms, irms; // Volts, amps
+	float p;          // Real power, W
+	float q;          // Reactive power, var, (+) when current lags
+	float s;          // Apparent power, VA
+	float pf;         // Power factor, P/S
+} pwr_result;
+
+typedef struct
+{
+	long  joules;     // Whole joules
+	float frac;       // Part of a joule not yet moved into 'joules'
+} pwr_energy;
+
+void  pwr_analyze (pwr_result *r, xdata int *v, xdata int *i, unsigned int n,
+                   float vscale, float iscale);
+void  pwr_energy_reset (pwr_energy *e);
+void  pwr_energy_add (pwr_energy *e, float watts, float seconds);
+float pwr_energy_wh (pwr_energy *e);
+
+#endif
@@ -0,0 +1,585 @@
+// pq.c:  Power-quality event detector for the AC meter
+//
+// Timer4_ISR() does all the work on its own time: one CH1/CH2 pair per
+// overflow, and what is due at the end of a half-cycle spread over the
+// overflows after it (one channel's RMS, the other's, then the ring, the
+// limits and the log), so no single interrupt holds the main loop off
+// for longer than ADC_GUARD (measure.h) and a pair.  The main program only changes
+// the settings and copies results out, with the interrupt held off.
+//
+// The C51 library's long multiply and divide are not reentrant, and the
+// main program uses them all the time, so nothing here calls them: the
+// squares and the limits are made of 8 x 8 products (Pq_Mul()), and a
+// cycle is always PQ_PAIRS pairs, so its mean square is a shift.
+
+#include <stdlib.h>
+#include <EFM8LB1.h>
+#include "../COMMON_EFM8LB1/timebase.h"
+#include "measure.h"
+#include "pq.h"
+
+#define TF4H 0x80  // TMR4CN0
+#define TR4  0x04
+
+#define PQ_MIN_TICKS (SYSCLK / 12 / PQ_MAX_HZ)
+#define PQ_MAX_TICKS (SYSCLK / 12 / PQ_MIN_HZ)
+
+// One conversion for the interrupt; the main program's go through
+// ADC_at_Pin(), which this must not call
+#define PQ_CONVERT(pin, x) { ADC0MX = (pin); ADINT = 0; ADBUSY = 1; while (!ADINT); (x) = ADC0; }
+
+// XRAM: RMS(1/2) ring and event log
+xdata unsigned int  pq_ring[PQ_RING][2];
+xdata unsigned char pq_ring_i;     // Next to write
+xdata pq_event      pq_log[PQ_LOG];
+xdata unsigned char pq_next;       // Log entry the next event takes
+xdata unsigned int  pq_count;
+xdata unsigned long pq_halves, pq_flagged;
+
+// Sums of squares of 12-bit codes and pairs in them: the half-cycle
+// being sampled, the one before, and the cycle of both latched for the
+// stages after a half-cycle ends.  *_bad: pairs were missed.  PQ_PAIRS
+// squares of 12-bit codes fit the sums.
+xdata unsigned long pq_sum[2], pq_prev[2], pq_done[2];
+xdata unsigned int  pq_n, pq_prev_n, pq_done_n;
+xdata unsigned char pq_bad, pq_prev_bad, pq_done_bad;
+
+xdata unsigned char pq_slot;       // Overflows into this half-cycle, of PQ_PAIRS / 2
+xdata unsigned int  pq_tick_q;     // Timer4 ticks a pair: period / PQ_PAIRS ...
+xdata unsigned char pq_tick_r, pq_tick_acc; // ... and the remainder, spread over the period
+xdata unsigned char pq_stage;      // Work left from the last half-cycle end
+xdata unsigned int  pq_rms[2];     // Latest RMS(1/2)
+xdata unsigned long pq_ref[2];     // Reference << PQ_REF_SHIFT, 0 = none yet
+xdata unsigned char pq_open[2];    // Log entry + 1 of the channel's open event, 0 = none
+xdata unsigned char pq_pct[4];     // Limits in percent: dip, swell, interruption, hysteresis
+xdata unsigned int  pq_lim[4];     // ... in 1/256 of the reference
+xdata unsigned char pq_away;       // Readings in a row outside PQ_MIN_HZ .. PQ_MAX_HZ
+xdata unsigned long pq_per;        // Period the half-cycles are timed from
+xdata unsigned long pq_new;        // Latest reading, in use or not
+// Rising crossings of half the peak, for pq_phase()
+xdata unsigned char pq_pos;        // Timer4 overflows, wraps
+xdata unsigned int  pq_thr[2];     // Half the peak in 12-bit codes, 0 = no reference
+xdata unsigned int  pq_last[2];    // The channel's previous sample
+xdata unsigned char pq_armed[2];   // Under pq_thr / 2 since the last crossing
+xdata unsigned char pq_x_pos[2];   // pq_pos of the first sample past pq_thr
+xdata unsigned int  pq_x_lo[2], pq_x_hi[2];  // The samples either side
+xdata unsigned char pq_scope;      // scope_next of the scope pair taken last
+bit pq_running;
+unsigned int pq_num;               // Number typed before a key
+
+#define LIM_DIP   0
+#define LIM_SWELL 1
+#define LIM_INT   2
+#define LIM_HYST  3
+
+
+// ----------------------------------------------------------------
+// Timer4 interrupt
+// ----------------------------------------------------------------
+
+// a * b from four 8 x 8 products, which C51 makes with MUL AB in line
+unsigned long Pq_Mul (unsigned int a, unsigned int b)
+{
+	unsigned char a0 = a, a1 = a >> 8, b0 = b, b1 = b >> 8;
+
+	return ((unsigned long)(unsigned int)(a1 * b1) << 16) +
+	       ((unsigned long)(unsigned int)(a1 * b0) << 8) +
+	       ((unsigned long)(unsigned int)(a0 * b1) << 8) +
+	       (unsigned int)(a0 * b0);
+}
+
+unsigned int Pq_Isqrt (unsigned long x)
+{
+	unsigned long r = 0, b = 1UL << 30;
+
+	while (b > x) b >>= 2;
+	while (b)
+	{
+		if (x >= r + b)
+		{
+			x -= r + b;
+			r = (r >> 1) + b;
+		}
+		else r >>= 1;
+		b >>= 2;
+	}
+	return (unsigned int)r;
+}
+
+// A new event on channel k in the next log entry, with the PQ_PRE
+// half-cycles before this one from the ring
+void Pq_Begin (unsigned char k, unsigned char type, unsigned int rms, unsigned int ref)
+{
+	pq_event xdata *e = &pq_log[pq_next];
+	unsigned char i, j;
+	unsigned long ms;
+	unsigned int n;
+
+	// The oldest entry goes, even if its event is still open
+	for (j = 0; j < 2; j++)
+		if (pq_open[j] == pq_next + 1) pq_open[j] = 0;
+
+	TB_READ(ms, n);
+	e->t_ms = ms + (n >= TB_TICKS_PER_MS);
+	e->chan = k;
+	e->type = type;
+	e->open = 1;
+	e->halves = 1;
+	e->extreme = rms;
+	e->ref = ref;
+	j = pq_ring_i - 1 - PQ_PRE;
+	for (i = 0; i <= PQ_PRE; i++, j++)
+	{
+		e->snap[i][0] = pq_ring[j & (PQ_RING - 1)][0];
+		e->snap[i][1] = pq_ring[j & (PQ_RING - 1)][1];
+	}
+	e->fill = PQ_PRE + 1;
+
+	pq_open[k] = pq_next + 1;
+	pq_next = (pq_next + 1) & (PQ_LOG - 1);
+	pq_count++;
+}
+
+// Channel k's RMS(1/2) against its reference and the limits
+void Pq_Check (unsigned char k, unsigned int rms)
+{
+	unsigned int ref = pq_ref[k] >> PQ_REF_SHIFT;
+	unsigned char type = 0;
+	pq_event xdata *e;
+
+	if (ref == 0)
+	{
+		if (rms >= PQ_MIN_RMS) pq_ref[k] = (unsigned long)rms << PQ_REF_SHIFT;
+		return;
+	}
+	if      (rms < Pq_Mul(ref, pq_lim[LIM_INT]) >> 8)   type = PQ_INTERRUPT_EV;
+	else if (rms < Pq_Mul(ref, pq_lim[LIM_DIP]) >> 8)   type = PQ_DIP_EV;
+	else if (rms > Pq_Mul(ref, pq_lim[LIM_SWELL]) >> 8) type = PQ_SWELL_EV;
+
+	if (!pq_open[k])
+	{
+		if (type) Pq_Begin(k, type, rms, ref);
+		else pq_ref[k] += rms - (pq_ref[k] >> PQ_REF_SHIFT);
+		return;
+	}
+
+	e = &pq_log[pq_open[k] - 1];
+	if (e->type == PQ_SWELL_EV)
+	{
+		if (rms > e->extreme) e->extreme = rms;
+		if (type == PQ_SWELL_EV || rms > Pq_Mul(ref, pq_lim[LIM_SWELL] - pq_lim[LIM_HYST]) >> 8)
+		{
+			if (e->halves != 0xFFFF) e->halves++;
+			return;
+		}
+	}
+	else
+	{
+		// A dip that goes under the interruption limit is an interruption
+		if (rms < e->extreme) e->extreme = rms;
+		if (type == PQ_INTERRUPT_EV) e->type = PQ_INTERRUPT_EV;
+		if (type == PQ_INTERRUPT_EV || type == PQ_DIP_EV ||
+		    rms < Pq_Mul(ref, pq_lim[LIM_DIP] + pq_lim[LIM_HYST]) >> 8)
+		{
+			if (e->halves != 0xFFFF) e->halves++;
+			return;
+		}
+	}
+	e->open = 0;
+	pq_open[k] = 0;
+	if (type) Pq_Begin(k, type, rms, ref);  // Straight from a dip into a swell
+}
+
+// Channel k's sample x, the one after pq_last[k]: a rising crossing?
+void Pq_Edge (unsigned char k, unsigned int x)
+{
+	unsigned int thr = pq_thr[k];
+
+	if (x < (thr >> 1)) pq_armed[k] = 1;
+	else if (pq_armed[k] && thr && x >= thr)
+	{
+		pq_armed[k] = 0;
+		pq_x_pos[k] = pq_pos;
+		pq_x_lo[k] = pq_last[k];
+		pq_x_hi[k] = x;
+	}
+	pq_last[k] = x;
+}
+
+// The cycle latched in pq_done[k] -> RMS(1/2) in 14-bit codes
+unsigned int Pq_Rms (unsigned char k)
+{
+	if (pq_done_bad || pq_done_n != PQ_PAIRS) return PQ_FLAGGED;
+	return Pq_Isqrt(pq_done[k] >> (PQ_PAIRS_SHIFT - 4));
+}
+
+void Timer4_ISR (void) interrupt INTERRUPT_TIMER4
+{
+	unsigned char mx, i;
+	bit ai, wi, run, scope, got = 1;
+	unsigned int x1, x2;
+	pq_event xdata *e;
+
+	SFRPAGE = 0x10;
+	TMR4CN0 &= ~TF4H;
+	// The overflow after next: PQ_PAIRS of them make the period exactly
+	pq_tick_acc += pq_tick_r;
+	if (pq_tick_acc >= PQ_PAIRS)
+	{
+		pq_tick_acc -= PQ_PAIRS;
+		TMR4RL = -(pq_tick_q + 1);
+	}
+	else TMR4RL = -pq_tick_q;
+	SFRPAGE = 0x0;
+	pq_pos++;
+
+	// A pair.  If Timer2 starts the conversions, a window run stops for
+	// it (its edges are stamped by the timebase, not Timer2), and a scope
+	// capture gives its latest pair instead: stopping would put a gap in
+	// its waveform.  That pair is up to a scope interval old, so it is no
+	// use for timing crossings.  The main program may be between setting
+	// up a conversion and starting it: leave the mux and flags as they
+	// were.
+	run = (ADC0CN2 & 0x0F) != ADCM_ADBUSY;
+	scope = run && !(EIE1 & EWADC0);
+	if (scope)
+	{
+		// None since the last overflow: an interval longer than a pair's
+		// share of the period
+		if (scope_next == pq_scope) got = 0;
+		else
+		{
+			pq_scope = scope_next;
+			i = (pq_scope - 1) & (SCOPE_N - 1);
+			x1 = scope_buf1[i];
+			x2 = scope_buf2[i];
+		}
+	}
+	else
+	{
+		if (run)
+		{
+			TR2 = 0;
+			while (ADBUSY);  // Let a triggered conversion finish
+			ADC0CN2 = ADCM_ADBUSY;
+		}
+		mx = ADC0MX;
+		ai = ADINT;
+		wi = ADWINT;
+		PQ_CONVERT(CH1, x1);
+		PQ_CONVERT(CH2, x2);
+		ADC0MX = mx;
+		ADINT  = ai;
+		ADWINT = wi;
+		if (run)
+		{
+			ADC0CN2 = ADCM_TIMER2;
+			TR2 = 1;
+		}
+	}
+
+	if (got)
+	{
+		// 12-bit codes whatever the profile
+		if (adc_full == 0x03FF)
+		{
+			x1 <<= 2;
+			x2 <<= 2;
+		}
+		else if (adc_full != 0x0FFF)
+		{
+			x1 >>= 2;
+			x2 >>= 2;
+		}
+		pq_sum[0] += Pq_Mul(x1, x1);
+		pq_sum[1] += Pq_Mul(x2, x2);
+		pq_n++;
+	}
+	else pq_bad = 1;
+	if (got && !scope)
+	{
+		Pq_Edge(0, x1);
+		Pq_Edge(1, x2);
+	}
+	else pq_armed[0] = pq_armed[1] = 0;  // No crossing across the gap
+
+	if (++pq_slot >= PQ_PAIRS / 2)
+	{
+		// End of a half-cycle: latch the cycle it ends
+		for (i = 0; i < 2; i++)
+		{
+			pq_done[i] = pq_prev[i] + pq_sum[i];
+			pq_prev[i] = pq_sum[i];
+			pq_sum[i] = 0;
+		}
+		pq_done_n = pq_prev_n + pq_n;
+		pq_prev_n = pq_n;
+		pq_n = 0;
+		pq_done_bad = pq_prev_bad | pq_bad;
+		pq_prev_bad = pq_bad;
+		pq_bad = 0;
+		pq_slot = 0;
+		pq_stage = 1;
+		return;
+	}
+
+	switch (pq_stage)
+	{
+		case 1:
+			pq_rms[0] = Pq_Rms(0);
+			pq_stage = 2;
+			break;
+		case 2:
+			pq_rms[1] = Pq_Rms(1);
+			pq_stage = 3;
+			break;
+		case 3:
+			pq_halves++;
+			if (pq_rms[0] == PQ_FLAGGED) pq_flagged++;
+			pq_ring[pq_ring_i][0] = pq_rms[0];
+			pq_ring[pq_ring_i][1] = pq_rms[1];
+			pq_ring_i = (pq_ring_i + 1) & (PQ_RING - 1);
+			for (i = 0; i < PQ_LOG; i++)
+			{
+				e = &pq_log[i];
+				if (e->fill >= PQ_SNAP) continue;
+				e->snap[e->fill][0] = pq_rms[0];
+				e->snap[e->fill][1] = pq_rms[1];
+				e->fill++;
+			}
+			if (pq_rms[0] != PQ_FLAGGED)
+			{
+				Pq_Check(0, pq_rms[0]);
+				Pq_Check(1, pq_rms[1]);
+			}
+			// RMS(1/2) of a half-wave input is half its peak, in 14-bit codes
+			pq_thr[0] = pq_ref[0] >> (PQ_REF_SHIFT + 2);
+			pq_thr[1] = pq_ref[1] >> (PQ_REF_SHIFT + 2);
+			pq_stage = 0;
+			break;
+		default:
+			break;
+	}
+}
+
+
+// ----------------------------------------------------------------
+// Main program side
+// ----------------------------------------------------------------
+
+void Pq_Set_Limit (unsigned char i, unsigned char pct)
+{
+	pq_pct[i] = pct;
+	pq_lim[i] = ((unsigned int)pct * 256 + 50) / 100;
+}
+
+// Timer4 on, with the half-cycles and the references starting over: the
+// first cycle is flagged, it has only half of its samples
+void Pq_Run (void)
+{
+	unsigned char held, i;
+
+	ADC_HOLD(held);
+	pq_sum[0] = pq_sum[1] = 0;
+	pq_n = 0;
+	pq_slot = 0;
+	pq_tick_acc = 0;
+	pq_bad = pq_prev_bad = 1;
+	pq_stage = 0;
+	for (i = 0; i < 2; i++)
+	{
+		pq_thr[i] = 0;
+		pq_armed[i] = 0;
+		pq_x_pos[i] = pq_pos - 0x80;  // Long ago
+		if (pq_open[i]) pq_log[pq_open[i] - 1].open = 0;
+		pq_open[i] = 0;
+		pq_ref[i] = 0;
+	}
+	ADC_RELEASE(held);
+
+	SFRPAGE = 0x10;
+	TMR4CN0 = 0x00;         // Stop; T4XCLK = 0: SYSCLK/12 (CKCON1 left at 0)
+	TMR4RL  = -pq_tick_q;
+	TMR4    = TMR4RL;
+	TMR4CN0 = TR4;
+	SFRPAGE = 0x00;
+	EIE2 |= ET4_MASK;
+	pq_running = 1;
+}
+
+void Pq_Stop (void)
+{
+	EIE2 &= ~ET4_MASK;
+	SFRPAGE = 0x10;
+	TMR4CN0 = 0x00;
+	SFRPAGE = 0x00;
+	pq_running = 0;
+}
+
+// Timer4 starts with the second of two readings in a row that agree
+void pq_start (void)
+{
+	Pq_Stop();
+	Pq_Set_Limit(LIM_DIP, PQ_DIP);
+	Pq_Set_Limit(LIM_SWELL, PQ_SWELL);
+	Pq_Set_Limit(LIM_INT, PQ_INTERRUPT);
+	Pq_Set_Limit(LIM_HYST, PQ_HYST);
+	pq_per = pq_new = 0;
+	pq_ring_i = 0;
+	pq_num = 0;
+	pq_clear();
+}
+
+// Empty the log and learn the references again
+void pq_clear (void)
+{
+	unsigned char held, i;
+
+	ADC_HOLD(held);
+	for (i = 0; i < PQ_LOG; i++)
+	{
+		pq_log[i].open = 0;
+		pq_log[i].fill = PQ_SNAP;
+	}
+	pq_open[0] = pq_open[1] = 0;
+	pq_ref[0] = pq_ref[1] = 0;
+	pq_next = 0;
+	pq_count = 0;
+	pq_halves = pq_flagged = 0;
+	ADC_RELEASE(held);
+}
+
+// Period of the latest reading, SYSCLK/12 ticks.  Readings outside mains
+// frequencies leave the half-cycle timing alone; PQ_AWAY of them in a row
+// stop Timer4 until two in range agree again.  A reading more than 1/32
+// away from the period in use needs the next one to agree with it: the
+// edges of a reading taken during a dip can be off by far more than that.
+void pq_period (unsigned long period_ticks)
+{
+	unsigned char held;
+	bit near_per, near_new;
+
+	if (period_ticks < PQ_MIN_TICKS || period_ticks > PQ_MAX_TICKS)
+	{
+		if (pq_running && ++pq_away >= PQ_AWAY) Pq_Stop();
+		return;
+	}
+	pq_away = 0;
+	near_per = pq_running && labs((long)(period_ticks - pq_per)) <= (long)(pq_per >> 5);
+	near_new = labs((long)(period_ticks - pq_new)) <= (long)(pq_new >> 5);
+	pq_new = period_ticks;
+	if (!near_per && !near_new) return;
+	pq_per = period_ticks;
+	ADC_HOLD(held);
+	pq_tick_q = period_ticks >> PQ_PAIRS_SHIFT;
+	pq_tick_r = period_ticks & (PQ_PAIRS - 1);
+	ADC_RELEASE(held);
+	if (!pq_running) Pq_Run();
+}
+
+// Keys: <percent>d dip limit, <percent>u swell limit, <percent>n
+// interruption limit, x clears the log.  Others are ignored.
+void pq_key (char c)
+{
+	if (c >= '0' && c <= '9')
+	{
+		pq_num = pq_num * 10 + (c - '0');
+		return;
+	}
+	switch (c)
+	{
+		case 'd': case 'D':
+			if (pq_num > pq_pct[LIM_INT] && pq_num < 100) Pq_Set_Limit(LIM_DIP, pq_num);
+			break;
+		case 'u': case 'U':
+			if (pq_num > 100 && pq_num <= 250) Pq_Set_Limit(LIM_SWELL, pq_num);
+			break;
+		case 'n': case 'N':
+			if (pq_num > 0 && pq_num < pq_pct[LIM_DIP]) Pq_Set_Limit(LIM_INT, pq_num);
+			break;
+		case 'x': case 'X':
+			pq_clear();
+			break;
+		default: break;
+	}
+	pq_num = 0;
+}
+
+void pq_get_status (pq_status *s)
+{
+	unsigned char held;
+
+	ADC_HOLD(held);
+	s->count = pq_count;
+	s->halves = pq_halves;
+	s->flagged = pq_flagged;
+	s->ref[0] = pq_ref[0] >> PQ_REF_SHIFT;
+	s->ref[1] = pq_ref[1] >> PQ_REF_SHIFT;
+	s->rms[0] = pq_rms[0];
+	s->rms[1] = pq_rms[1];
+	ADC_RELEASE(held);
+	s->dip = pq_pct[LIM_DIP];
+	s->swell = pq_pct[LIM_SWELL];
+	s->interruption = pq_pct[LIM_INT];
+	s->running = pq_running;
+}
+
+// Copy of the i-th newest event in the log (0 = the latest); 0 if the
+// log holds fewer
+bit pq_get_event (unsigned char i, pq_event *e)
+{
+	unsigned char held;
+	bit ok;
+
+	ADC_HOLD(held);
+	ok = (i < PQ_LOG && i < pq_count);
+	if (ok) *e = pq_log[(pq_next - 1 - i) & (PQ_LOG - 1)];
+	ADC_RELEASE(held);
+	return ok;
+}
+
+// Where thr falls between the samples lo and hi, 0 .. 1
+float Pq_Frac (unsigned int thr, unsigned int lo, unsigned int hi)
+{
+	if (thr <= lo || hi <= lo) return 0;
+	if (thr >= hi) return 1;
+	return (float)(thr - lo) / (hi - lo);
+}
+
+// Phase of CH1 relative to CH2 from the latest rising crossings, in
+// degrees, (+) when CH1 leads, as the readings give it.  0 if Timer4 is
+// off or either channel has not crossed in the last cycle and a half.
+bit pq_phase (float *deg)
+{
+	unsigned char held, pos, p1, p2;
+	unsigned int thr1, lo1, hi1, thr2, lo2, hi2;
+	float d;
+
+	ADC_HOLD(held);
+	pos = pq_pos;
+	p1 = pq_x_pos[0];
+	p2 = pq_x_pos[1];
+	thr1 = pq_thr[0];
+	lo1 = pq_x_lo[0];
+	hi1 = pq_x_hi[0];
+	thr2 = pq_thr[1];
+	lo2 = pq_x_lo[1];
+	hi2 = pq_x_hi[1];
+	ADC_RELEASE(held);
+
+	if (!pq_running) return 0;
+	if ((unsigned char)(pos - p1) > PQ_PAIRS * 3 / 2 ||
+	    (unsigned char)(pos - p2) > PQ_PAIRS * 3 / 2) return 0;
+	// Pairs from CH1's crossing to CH2's, within half a period
+	d = (signed char)(p2 - p1) + Pq_Frac(thr2, lo2, hi2) - Pq_Frac(thr1, lo1, hi1);
+	while (d > PQ_PAIRS / 2)  d -= PQ_PAIRS;
+	while (d < -PQ_PAIRS / 2) d += PQ_PAIRS;
+	*deg = d * (360.0 / PQ_PAIRS);
+	return 1;
+}
+
+// RMS(1/2) -> volts RMS of the sine before the half-wave rectifier
+float pq_volts (unsigned int rms)
+{
+	return rms * (1.41421356237 * VDD / ADC_FULL);
+}
@@ -0,0 +1,108 @@
+// pq.h:  Power-quality event detector for the AC meter
+//
+// Timer4 interrupts PQ_PAIRS times a period and converts CH1
+// and CH2 in between the main loop's own conversions (see ADC_HOLD() in
+// measure.h), so every half-cycle is seen while the loop measures,
+// reports and waits on the LCD.  Per channel, at the end of each
+// half-cycle:
+//
+//   RMS(1/2)   RMS over the last cycle, refreshed every half-cycle (the
+//              Urms(1/2) of IEC 61000-4-30).  The inputs are half-wave
+//              rectified, so a half-cycle on its own is either the hump
+//              or nothing; the cycle before it holds one of each.
+//   reference  RMS(1/2) averaged over about PQ_REF_HALVES half-cycles,
+//              frozen during an event
+//
+// A value under the dip or interruption limit or over the swell limit,
+// in percent of the reference, starts an event; it ends when the values
+// are back PQ_HYST percent inside the limit.  The log keeps the last
+// PQ_LOG events, each with a snapshot of both channels' RMS(1/2): PQ_PRE
+// half-cycles before the first one past the limit, that one, and the
+// rest of PQ_SNAP after it.
+//
+// The half-cycles are timed from the period the main loop measures
+// (pq_period()); Timer4 starts, and the references are learned again,
+// once two readings in a row agree on a mains frequency.  While Timer2
+// starts the conversions the pairs still come in: a window run ('e') is
+// stopped for the time of each pair, and a scope capture ('s') gives its
+// latest one.  Half-cycles that miss a pair all the same (a scope
+// interval longer than a pair's share of the period) are incomplete:
+// they are counted as flagged, logged as PQ_FLAGGED and never compared
+// against the limits.
+//
+// Each channel's latest rising crossing of half its peak (half its
+// reference, whose samples either side are kept) gives pq_phase(), the
+// phase of the last cycle, for a display that moves between readings.
+// The scope's pairs are not taken when the interrupt runs, so they time
+// no crossings.
+//
+// The interrupt also lands in the main loop's edge waits: at 50/60 Hz it
+// adds up to 0.2 degrees to the threshold phase of a reading and 0.04%
+// to its period.  The blocks are guarded for as long as the interrupt can
+// run in the block's profile (ADC_GUARD and a pair, measure.h), so the
+// Goertzel phase does not change.
+//
+// XRAM: about 650 bytes for the ring, the log and the state.
+
+#ifndef PQ_H
+#define PQ_H
+
+#define PQ_PAIRS_SHIFT 6     // CH1/CH2 pairs a period: 64, 3.2 kHz at 50 Hz
+#define PQ_PAIRS       (1 << PQ_PAIRS_SHIFT)
+#define PQ_MIN_HZ      40    // Readings outside this range are not mains:
+#define PQ_MAX_HZ      70    // ignored, and PQ_AWAY in a row stop Timer4
+#define PQ_AWAY        8
+#define PQ_RING        16    // Half-cycles of RMS(1/2) kept, power of two
+#define PQ_LOG         8     // Events kept
+#define PQ_PRE         4     // Snapshot half-cycles before the trigger
+#define PQ_SNAP        12    // Snapshot half-cycles in all
+#define PQ_REF_SHIFT   10    // Reference follows 1/1024 of each new value:
+#define PQ_REF_HALVES  (1 << PQ_REF_SHIFT)  // ~10 s at 50 Hz
+#define PQ_MIN_RMS     100   // ADC codes; a smaller RMS(1/2) never sets a reference
+#define PQ_FLAGGED     0xFFFF
+
+// Default limits, percent of the reference ('d', 'u', 'n' change them)
+#define PQ_DIP         90
+#define PQ_SWELL       110
+#define PQ_INTERRUPT   10
+#define PQ_HYST        2
+
+// pq_event.type, worst seen so far
+#define PQ_DIP_EV        1
+#define PQ_SWELL_EV      2
+#define PQ_INTERRUPT_EV  3
+
+typedef struct
+{
+	unsigned long t_ms;   // Timebase ms at the end of the first half-cycle past the limit
+	unsigned char chan;   // 0 = CH1, 1 = CH2
+	unsigned char type;   // PQ_..._EV
+	unsigned char open;   // Still going
+	unsigned char fill;   // Snapshot half-cycles filled in so far
+	unsigned int  halves; // Half-cycles from the start to the end (saturates)
+	unsigned int  extreme;// Lowest (dip, interruption) or highest (swell) RMS(1/2)
+	unsigned int  ref;    // Reference at the start
+	unsigned int  snap[PQ_SNAP][2];  // RMS(1/2) of CH1, CH2; the trigger at PQ_PRE
+} pq_event;
+
+typedef struct
+{
+	unsigned int  count;    // Events since pq_clear(), also those no longer in the log
+	unsigned long halves;   // Half-cycles seen
+	unsigned long flagged;  // ... of which incomplete
+	unsigned int  ref[2];   // Reference of CH1, CH2, 0 = none yet
+	unsigned int  rms[2];   // Latest RMS(1/2)
+	unsigned char dip, swell, interruption;  // Limits, percent
+	unsigned char running;  // Timer4 on: the input is mains or absent
+} pq_status;
+
+void  pq_start (void);
+void  pq_clear (void);
+void  pq_period (unsigned long period_ticks);
+void  pq_key (char c);
+void  pq_get_status (pq_status *s);
+bit   pq_get_event (unsigned char i, pq_event *e);
+float pq_volts (unsigned int rms);
+bit   pq_phase (float *deg);
+
+#endif
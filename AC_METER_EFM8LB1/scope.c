@@ -0,0 +1,131 @@
+// scope.c:  Triggered waveform capture streamed over UART0 (scope mode)
+//
+// The settings are keys, accepted in every display mode so a PC program
+// can send them ahead of the 's'.  A number typed before 'l', 't', 'i' or
+// 'c' is its argument:
+//
+//   <mV>l   trigger level, 0 = midway between the channel's edge thresholds
+//   <n>t    pairs kept before the trigger, 0 .. SCOPE_N-1
+//   <us>i   microseconds per pair, 0 = SCOPE_CYCLES periods per block
+//   <1|2>c  trigger channel
+//   / \    rising / falling edge
+
+#include <EFM8LB1.h>
+#include "serial.h"
+#include "measure.h"
+#include "scope.h"
+
+scope_trig scope;
+unsigned int scope_mv;    // Trigger level in mV, 0 = automatic
+unsigned int scope_us;    // Microseconds per pair, 0 = automatic
+unsigned int scope_num;   // Digits typed so far
+unsigned char scope_seq;
+unsigned int scope_s1, scope_s2;  // Fletcher-16 sums of the frame so far
+
+void Scope_Reset (void)
+{
+	scope.pin = CH1;
+	scope.falling = 0;
+	scope.pre = SCOPE_N / 4;
+	scope_mv = 0;
+	scope_us = 0;
+	scope_num = 0;
+}
+
+void Scope_Key (char c)
+{
+	if (c >= '0' && c <= '9')
+	{
+		scope_num = scope_num * 10 + (c - '0');
+		return;
+	}
+	switch (c)
+	{
+		case 'l': case 'L': scope_mv = scope_num; break;
+		case 't': case 'T': scope.pre = (scope_num < SCOPE_N) ? scope_num : SCOPE_N - 1; break;
+		case 'i': case 'I': scope_us = scope_num; break;
+		case 'c': case 'C': scope.pin = (scope_num == 2) ? CH2 : CH1; break;
+		case '/':  scope.falling = 0; break;
+		case '\\': scope.falling = 1; break;
+		default: break;
+	}
+	scope_num = 0;
+}
+
+// Timer2 ticks per pair: even, and no shorter than the block profile
+// allows
+unsigned int Scope_Interval (unsigned long period_ticks)
+{
+	unsigned long t;
+	unsigned int least = Scope_Min_Interval();
+
+	if (scope_us) t = (unsigned long)scope_us * (SYSCLK / 12 / 1000000L);
+	else if (period_ticks) t = period_ticks * SCOPE_CYCLES / SCOPE_N;
+	else t = SCOPE_IDLE;
+	if (t < least) t = least;
+	if (t > 0xFFFE) t = 0xFFFE;
+	return (unsigned int)t & ~1;
+}
+
+// Trigger level as an ADC code; the automatic one sits between the edge
+// thresholds measure.c tracks, so it follows the input's amplitude
+unsigned int Scope_Level (void)
+{
+	meas_chan *c = (scope.pin == CH2) ? &meas_ch2 : &meas_ch1;
+	float v = scope_mv ? scope_mv * 0.001 : (c->rise + c->fall) / 2;
+
+	if (v > VDD) v = VDD;
+	return (unsigned int)(v * ADC_FULL / VDD);
+}
+
+void Put_Byte (unsigned char b)
+{
+	scope_s1 += b;
+	if (scope_s1 >= 255) scope_s1 -= 255;
+	scope_s2 += scope_s1;
+	if (scope_s2 >= 255) scope_s2 -= 255;
+	serial_write((char *)&b, 1);
+}
+
+void Put_Word (unsigned int w)
+{
+	Put_Byte(w & 0xFF);
+	Put_Byte(w >> 8);
+}
+
+// Capture one block and queue its frame.  Queueing waits for room, so
+// the capture of the next block overlaps the end of this one on the wire.
+void Scope_Frame (unsigned long period_ticks)
+{
+	unsigned int i, k;
+	unsigned char flags = 0;
+	char sync[2];
+
+	scope.interval = Scope_Interval(period_ticks);
+	scope.level = Scope_Level();
+	Capture_Triggered(&scope);
+
+	if (scope.pin == CH2) flags |= SCOPE_F_CH2;
+	if (scope.falling)    flags |= SCOPE_F_FALLING;
+	if (scope.forced)     flags |= SCOPE_F_FORCED;
+
+	sync[0] = SCOPE_SYNC1;
+	sync[1] = SCOPE_SYNC2;
+	serial_write(sync, 2);
+	scope_s1 = scope_s2 = 0;
+	Put_Byte(scope_seq++);
+	Put_Byte(flags);
+	Put_Word(SCOPE_N);
+	Put_Word(scope.pre);
+	Put_Word(scope.interval);
+	Put_Word(scope.level);
+	Put_Word(ADC_FULL);
+	for (i = 0, k = scope.start; i < SCOPE_N; i++, k = (k + 1) & (SCOPE_N - 1))
+	{
+		Put_Word(scope_buf1[k]);
+		Put_Word(scope_buf2[k]);
+	}
+	sync[0] = scope_s1;
+	sync[1] = scope_s2;
+	serial_write(sync, 2);
+}
@@ -0,0 +1,43 @@
+// scope.h:  Triggered waveform capture streamed over UART0 (scope mode)
+//
+// 's' switches the serial port to SCOPE_BAUD and streams blocks of raw
+// CH1/CH2 samples from Capture_Triggered() (measure.c) as binary frames,
+// 'p', 'h' or 'w' at that rate switch back.  host/scope_rx receives and
+// saves the frames on Linux.  Frame layout, words little-endian:
+//
+//    0  0xA5 0x5A   sync
+//    2  seq         byte, +1 per frame (gaps are frames the PC lost)
+//    3  flags       SCOPE_F_...
+//    4  n           pairs in the frame (SCOPE_N)
+//    6  pre         pairs before the trigger pair
+//    8  interval    SYSCLK/12 ticks per pair; CH2 is converted half of it
+//                   after CH1
+//   10  level       trigger level, ADC code
+//   12  full        ADC code of VDD
+//   14  samples     n x (CH1, CH2), oldest first
+//  +4n  check       Fletcher-16 of bytes 2 .. 13+4n: sum1 low, sum2 high
+//
+// A frame is 1040 bytes, 3.5 ms at 3 Mbaud: blocks of a few cycles of
+// mains take much longer to capture than to send.
+
+#ifndef SCOPE_H
+#define SCOPE_H
+
+#define SCOPE_BAUD   3000000L  // Exact from 72 MHz, see serial_baud()
+#define SCOPE_CYCLES 2         // Periods per block with the interval on auto
+#define SCOPE_IDLE   780       // Ticks per pair on auto with no period (~60 Hz)
+#define SCOPE_BURST  8         // Frames between readings of the period
+
+#define SCOPE_SYNC1 0xA5
+#define SCOPE_SYNC2 0x5A
+
+// Frame flags
+#define SCOPE_F_CH2     0x01  // Triggered on CH2, else CH1
+#define SCOPE_F_FALLING 0x02  // On the falling edge, else the rising one
+#define SCOPE_F_FORCED  0x04  // No edge in time: the block is untriggered
+
+void Scope_Reset (void);
+void Scope_Key (char c);
+void Scope_Frame (unsigned long period_ticks);
+
+#endif
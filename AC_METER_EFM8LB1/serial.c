@@ -0,0 +1,164 @@
+// serial.c:  Interrupt-driven UART0 for the AC meter
+//
+// Timer1 still generates the baud rate (see _c51_external_startup()),
+// serial_baud() changes it later.  The 16-bit ring indices are shared
+// with the ISR, so the main program only touches them with ES0 cleared.
+
+#include <stdio.h>
+#include <EFM8LB1.h>
+#include "serial.h"
+
+#define SYSCLK 72000000L
+#define TX_MASK (SERIAL_TX_SIZE - 1)
+#define RX_MASK (SERIAL_RX_SIZE - 1)
+
+xdata char tx_buf[SERIAL_TX_SIZE];
+volatile unsigned int tx_head;  // Next free slot, written by putchar()
+volatile unsigned int tx_tail;  // Next to send, written by the ISR
+volatile unsigned int tx_dropped;
+volatile bit tx_busy;           // A character is in SBUF0
+xdata char rx_buf[SERIAL_RX_SIZE];
+volatile unsigned char rx_head;  // Written by the ISR
+volatile unsigned char rx_tail;  // Written by serial_getkey()
+unsigned char tx_policy;
+
+void serial_init (unsigned char policy)
+{
+	ES0 = 0;
+	tx_head = tx_tail = 0;
+	tx_dropped = 0;
+	tx_busy = 0;
+	rx_head = rx_tail = 0;
+	tx_policy = policy;
+	TI = 0; // The polled putchar() needed TI = 1 at startup; the ISR must not see it
+	RI = 0;
+	ES0 = 1;
+}
+
+void serial_policy (unsigned char policy)
+{
+	tx_policy = policy;
+}
+
+void UART0_ISR (void) interrupt INTERRUPT_UART0
+{
+	SFRPAGE = 0x0;
+	if (TI)
+	{
+		TI = 0;
+		if (tx_tail != tx_head)
+		{
+			SBUF0 = tx_buf[tx_tail];
+			tx_tail = (tx_tail + 1) & TX_MASK;
+		}
+		else tx_busy = 0;
+	}
+	if (RI)
+	{
+		// A full queue drops the new key
+		if (((rx_head + 1) & RX_MASK) != rx_tail)
+		{
+			rx_buf[rx_head] = SBUF0;
+			rx_head = (rx_head + 1) & RX_MASK;
+		}
+		RI = 0;
+	}
+}
+
+void serial_put (char c)
+{
+	unsigned int next;
+
+	ES0 = 0;
+	if (!tx_busy)
+	{
+		// Transmitter idle: start it directly, the ISR takes it from here
+		tx_busy = 1;
+		SBUF0 = c;
+	}
+	else
+	{
+		next = (tx_head + 1) & TX_MASK;
+		if (next == tx_tail)
+		{
+			tx_dropped++;
+			if (tx_policy == SERIAL_DROP) { ES0 = 1; return; }
+			tx_tail = (tx_tail + 1) & TX_MASK;
+		}
+		tx_buf[tx_head] = c;
+		tx_head = next;
+	}
+	ES0 = 1;
+}
+
+// Queue n bytes unchanged, waiting for room rather than dropping: binary
+// frames (scope.c) must arrive whole
+void serial_write (char *p, unsigned int n)
+{
+	bit full;
+
+	while (n--)
+	{
+		do
+		{
+			ES0 = 0;
+			full = tx_busy && ((tx_head + 1) & TX_MASK) == tx_tail;
+			ES0 = 1;
+		} while (full);
+		serial_put(*p++);
+	}
+}
+
+// Send everything queued, then reprogram Timer1.  Up to 115200 baud
+// Timer1 counts SYSCLK/12 like at startup; above it counts SYSCLK, where
+// 72 MHz / 2 / (256 - TH1) gives 1.5, 2 and 3 Mbaud exactly, rates the
+// FT230X USB bridge also divides exactly.
+void serial_baud (unsigned long baud)
+{
+	while (tx_busy);
+	TR1 = 0;
+	if (SYSCLK / 2 / baud <= 256)
+	{
+		CKCON0 |= 0x08;  // T1M: SYSCLK
+		TH1 = 0x100 - SYSCLK / 2 / baud;
+	}
+	else
+	{
+		CKCON0 &= ~0x08; // SYSCLK/12
+		TH1 = 0x100 - (SYSCLK / baud) / (2L * 12L);
+	}
+	TL1 = TH1;
+	TR1 = 1;
+}
+
+// Never waits for the UART.  Like the library putchar(), '\n' goes out as
+// CR LF for PuTTY.
+char putchar (char c)
+{
+	if (c == '\n') serial_put('\r');
+	serial_put(c);
+	return c;
+}
+
+// Oldest key not yet read, or 0 if none
+char serial_getkey (void)
+{
+	char c = 0;
+
+	if (rx_tail != rx_head)
+	{
+		c = rx_buf[rx_tail];
+		rx_tail = (rx_tail + 1) & RX_MASK;
+	}
+	return c;
+}
+
+unsigned int serial_dropped (void)
+{
+	unsigned int n;
+
+	ES0 = 0;
+	n = tx_dropped;
+	ES0 = 1;
+	return n;
+}
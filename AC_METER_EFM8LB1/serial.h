@@ -0,0 +1,25 @@
+// serial.h:  Interrupt-driven UART0 for the AC meter
+//
+// putchar() queues into an XRAM ring buffer that the UART0 ISR drains, so
+// printing a report costs a few microseconds per character instead of the
+// ~87 us each character takes on the wire at 115200 baud.  The ISR also
+// queues received keys for serial_getkey().  putchar() keeps its <stdio.h>
+// prototype, so it is not redeclared here.
+
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#define SERIAL_TX_SIZE 1024  // Power of two; holds the longest report
+#define SERIAL_RX_SIZE 16    // Power of two; keys a PC program sends at once
+
+#define SERIAL_DROP      0   // Buffer full: discard the new character
+#define SERIAL_OVERWRITE 1   // Buffer full: discard the oldest queued one
+
+void serial_init (unsigned char policy);
+void serial_policy (unsigned char policy);
+void serial_baud (unsigned long baud);
+void serial_write (char *p, unsigned int n);
+char serial_getkey (void);
+unsigned int serial_dropped (void);
+
+#endif
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <EFM8LB1.h>
+#include "../COMMON_EFM8LB1/timebase.h"
 
 // ~C51~
 
@@ -114,6 +115,9 @@ char _c51_external_startup (void)
 	TMR2    = 0x0000;
 	ET2     = 0;
 
+	// Timer 3 - shared timebase (timebase.c): LCD delays and waits
+	Timebase_Init();
+
 	EA = 1;
 	return 0;
 }
@@ -141,33 +145,10 @@ void Timer1_ISR (void) interrupt INTERRUPT_TIMER1
 // LCD functions (ported from working capacitance meter)
 // ----------------------------------------------------------------
 
-void Timer3us (unsigned char us)
-{
-	unsigned char i;
-	CKCON0 |= 0b_0100_0000;
-	TMR3RL   = (-(SYSCLK)/1000000L);
-	TMR3     = TMR3RL;
-	TMR3CN0  = 0x04;
-	for (i = 0; i < us; i++)
-	{
-		while (!(TMR3CN0 & 0x80));
-		TMR3CN0 &= ~(0x80);
-	}
-	TMR3CN0 = 0;
-}
-
-void waitms (unsigned int ms)
-{
-	unsigned int j;
-	unsigned char k;
-	for (j = 0; j < ms; j++)
-		for (k = 0; k < 4; k++) Timer3us(250);
-}
-
 void LCD_pulse (void)
 {
 	LCD_E = 1;
-	Timer3us(40);
+	Delay_us(40);
 	LCD_E = 0;
 }
 
@@ -176,7 +157,7 @@ void LCD_byte (unsigned char x)
 	ACC = x;
 	LCD_D7 = ACC_7; LCD_D6 = ACC_6; LCD_D5 = ACC_5; LCD_D4 = ACC_4;
 	LCD_pulse();
-	Timer3us(40);
+	Delay_us(40);
 	ACC = x;
 	LCD_D7 = ACC_3; LCD_D6 = ACC_2; LCD_D5 = ACC_1; LCD_D4 = ACC_0;
 	LCD_pulse();
@@ -2,10 +2,30 @@
 ; ELEC 291 LAB 2 ALARM CLOCK JANUARY 20 2026
 
 ; ISR_example.asm: a) Increments/decrements a BCD variable every half second using
-; an ISR for timer 2; b) Generates a 2kHz square wave at pin P1.7 using
-; an ISR for timer 0; and c) in the 'main' loop it displays the variable
+; an ISR for timer 2; b) Plays the alarm on a speaker at P0.5 from the PWM
+; (PWM2, no ISR); and c) in the 'main' loop it displays the variable
 ; incremented/decremented using the ISR for timer 2 on the LCD.  Also resets it to 
 ; zero if the 'CLEAR' push button connected to P1.5 is pressed.
+;
+; Clock trim: hold CLEAR for 1.5s for trim mode, where the hours button adds
+; 10ppm, the minutes button 1ppm and the AM/PM button flips the sign (+ runs
+; the clock faster).  Hold CLEAR again to leave; the trim is saved to flash.
+; In trim mode the seconds button steps the day of the week on line 1, and
+; ALARM the alarm melody (M1-M4, played once to hear it), saved with the trim.
+;
+; Alarms: a table of ALARMS, one on line 2 at a time: "1 12:00AM D5 OFF" is
+; alarm 1, its time, repeat, snooze minutes and on/off.  Hold ALARM for 1s
+; for the next one.  ALARM turns the one shown on or off, and while it is on
+; the hours, minutes and AM/PM buttons set its time, the seconds button its
+; repeat (O once, D daily, W Mon-Fri, S Sat+Sun) and CLEAR its snooze (0-9
+; minutes, 0 for none).  While an alarm rings, ALARM stops it and AM/PM
+; snoozes it.
+;
+; Power: with no button event and no new second the main loop idles (PCON
+; IDL) until the next interrupt, at most 1ms away.  Once a second a line goes
+; out on TXD (P0.6, 115200 8N1), in hex: "w03E8 b01 a00A1B2" is the wakes
+; from idle, the passes that had work and the Timer0 ticks (Fsys/12) the CPU
+; was not idle, for a duty cycle of a x 12 / 16.6MHz.
 $NOLIST
 $MODN76E003
 $LIST
@@ -26,26 +46,82 @@ $LIST
 ;
 
 CLK           EQU 16600000 ; Microcontroller system frequency in Hz
-TIMER0_RATE   EQU 4096     ; 2048Hz squarewave (peak amplitude of CEM-1203 speaker)
-TIMER0_RELOAD EQU ((65536-(CLK/TIMER0_RATE)))
+PWM_CLK       EQU (CLK/8)  ; PWMCON1 divider 1/8
 TIMER2_RATE   EQU 1000     ; 1000Hz, for a timer tick of 1ms
 TIMER2_RELOAD EQU ((65536-(CLK/TIMER2_RATE)))
+BAUD          EQU 115200
+TIMER1_RELOAD EQU (256-((CLK+8*BAUD)/(16*BAUD))) ; SMOD = 1, Timer1 from Fsys
+
+; Clock trim, set in trim mode (hold CLEAR for TRIM_HOLD x 10ms) and kept in
+; the last 128-byte page of the 18K APROM (CONFIG1 with no LDROM)
+TRIM_HOLD     EQU 150      ; 1.5 s
+TRIM_FLASH    EQU 0x4780
+TRIM_MAGIC    EQU 0xA5     ; First byte of a saved trim; erased flash reads 0xFF
+IAP_ERASE     EQU 0x22     ; IAPCN: APROM page erase
+IAP_PROGRAM   EQU 0x21     ; IAPCN: APROM byte program
+
+; Alarm table entries: hours, minutes (BCD), flags, snooze minutes (binary)
+ALARMS        EQU 8        ; Power of two
+ALARM_SIZE    EQU 4        ; Alarm_Ptr multiplies by it with two rl
+ALM_ON        EQU 0x01     ; flags bit 0
+ALM_PM        EQU 0x02     ; flags bit 1
+ALM_REPEAT    EQU 0x0C     ; flags bits 2-3, REPEAT_x
+REPEAT_ONCE   EQU 0        ; A one-off alarm is turned off once it has rung
+REPEAT_DAILY  EQU 1
+SNOOZE_MIN    EQU 5        ; Snooze of a new alarm, minutes
+SELECT_HOLD   EQU 100      ; ALARM held 1 s (x 10ms): the next alarm
+
+; Notes, as PWM periods less one.  A melody is note index (0 rests), 10ms
+; steps, ... MEL_END.
+NOTE_BEEP     EQU (PWM_CLK/2048-1) ; The old Timer0 tone (peak amplitude of CEM-1203 speaker)
+NOTE_G5       EQU (PWM_CLK/784-1)
+NOTE_C6       EQU (PWM_CLK/1047-1)
+NOTE_D6       EQU (PWM_CLK/1175-1)
+NOTE_E6       EQU (PWM_CLK/1319-1)
+NOTE_G6       EQU (PWM_CLK/1568-1)
+NOTE_C7       EQU (PWM_CLK/2093-1)
+N_BEEP        EQU 1        ; Index in Notes
+N_G5          EQU 2
+N_C6          EQU 3
+N_D6          EQU 4
+N_E6          EQU 5
+N_G6          EQU 6
+N_C7          EQU 7
+MEL_END       EQU 0xFF
+MELODY_COUNT  EQU 4        ; Power of two
+
+; Buttons, sampled by Timer2_ISR (see Buttons_Sample).  Events in btn_queue
+; are EV_x + BTN_x.
+BUTTONS       EQU 6
+BTN_ALARM     EQU 0
+BTN_AMPM      EQU 1
+BTN_CLEAR     EQU 2
+BTN_HOURS     EQU 3
+BTN_MINUTES   EQU 4
+BTN_SECONDS   EQU 5
+REPEAT_BUTTONS EQU 00111000B ; Hours, minutes, seconds repeat while held
+EV_PRESS      EQU 0x00 ; Pressed, or another repeat
+EV_HOLD       EQU 0x10 ; Held for its hold time (Button_Hold_Of)
+EV_RELEASE    EQU 0x20 ; Let go before its hold time
+DEBOUNCE_MS   EQU 20   ; Integrator length
+REPEAT_FIRST  EQU 50   ; First repeat after 500ms (x 10ms) ...
+REPEAT_RATE   EQU 15   ; ... then every 150ms
+BTN_QUEUE_LEN EQU 8    ; Events queued, power of two
 
 ALARM_BUTTON  equ P0.4 
 UPDOWN        equ P1.1
 CLEAR_BUTTON  equ P1.5
-SOUND_OUT     equ P1.7
+SOUND_OUT     equ P0.5 ; PWM2, see Pwm_Init
 AMPM_BUTTON   equ P1.2
+HOURS_BUTTON  equ P3.0
+MINUTES_BUTTON equ P1.6
+SECONDS_BUTTON equ P1.1 ; Also UPDOWN
 ;555_rst 	  equ P1.0
 
 ; Reset vector
 org 0x0000
     ljmp main
     
-; External interrupt 0
-org 0x0003
-    ljmp HOURS_ISR
-
 ; Timer0 overflow interrupt vector
 org 0x000B
     ljmp Timer0_ISR
@@ -54,11 +130,21 @@ org 0x000B
 org 0x002B
     ljmp Timer2_ISR
 
-org 0x003B
-    ljmp PINS_ISR
-
 ;------------------------DATA SEGMENT----------------------------------------------------------;
 
+; Register banks 2 and 3 are not used: the button state, which only
+; Timer2_ISR and Button_Get touch
+dseg at 0x10
+btn_count:     ds BUTTONS ; Integrators, 0-DEBOUNCE_MS
+btn_time:      ds BUTTONS ; 10ms steps held, 0 = not pressed
+btn_tick:      ds 1 ; 1ms ticks to the next 10ms step
+btn_head:      ds 1 ; btn_queue index Timer2_ISR writes next
+btn_tail:      ds 1 ; ... and Button_Get reads next
+
+; Indirect RAM, reached through @r0 only, with the stack above it
+alarm_table   EQU 0x80 ; ALARMS*ALARM_SIZE bytes
+STACK_BASE    EQU (alarm_table+ALARMS*ALARM_SIZE)
+
 ; In the 8051 we can define direct access variables starting at location 0x30 up to location 0x7F
 dseg at 0x30        ; datasegment
 Count1ms:      ds 2 ; 16-bit counter for the 1ms ticks
@@ -67,6 +153,43 @@ minutes:       ds 1 ; Current BCD minutes
 hours:         ds 1 ; Current BCD hours
 alarm_minutes: ds 1 ; Alarm BCD minutes
 alarm_hours:   ds 1 ; Alarm BCD hours
+trim:          ds 2 ; Clock trim, BCD ppm 000-999 (trim+1 holds the hundreds)
+trim_acc:      ds 2 ; BCD us the clock is owed, one trim per second
+lcd_char:      ds 1 ; Character for Display_char()
+; What the LCD shows, so only fields that changed are written (0xFF: redraw)
+shown_hours:         ds 1
+shown_minutes:       ds 1
+shown_seconds:       ds 1
+shown_clock_AMPM:    ds 1 ; 0 = AM, 1 = PM
+shown_alarm_hours:   ds 1
+shown_alarm_minutes: ds 1
+shown_alarm_AMPM:    ds 1
+shown_weekday:       ds 1
+shown_alarm_sel:     ds 1
+shown_alarm_repeat:  ds 1
+shown_alarm_snooze:  ds 1
+shown_alarm_on:      ds 1
+alarm_sel:     ds 1 ; Alarm on line 2, the buttons edit it in alarm_hours etc.
+alarm_repeat:  ds 1 ; REPEAT_x of alarm_sel
+alarm_snooze:  ds 1 ; Snooze minutes of alarm_sel, 0-9
+weekday:       ds 1 ; 0 = Sunday
+; Minutes since midnight (low byte first): the clock's, the next alarm's
+; and a snoozed alarm's, 0xFFFF for none
+now_key:       ds 2
+next_key:      ds 2
+snooze_key:    ds 2
+key_minutes:   ds 1 ; minutes when now_key was worked out
+next_slot:     ds 1 ; Alarm of next_key, 0xFF for the snooze
+ring_slot:     ds 1 ; Alarm ringing or snoozed
+btn_queue:     ds BTN_QUEUE_LEN
+melody:        ds 1 ; Alarm melody, 0 to MELODY_COUNT-1
+mel_pos:       ds 1 ; Next step, offset in Melodies
+note_left:     ds 1 ; 10ms steps left of the note playing
+wakes:         ds 2 ; Wakes from idle this second, low byte first
+busy_passes:   ds 1 ; ... and main loop passes with work
+t0_over:       ds 1 ; Timer0 overflows this second: the top of the active time
+stats:         ds 6 ; Last second's wakes, busy_passes, active time, high byte first
+stats_pos:     ds 1 ; Next character of the stats line, 0 = none
 
 
 ;-----------------------BINARY SEGMENT---------------------------------------------------------;
@@ -75,6 +198,20 @@ seconds_flag: dbit 1 ; UPDATED FROM EXAMPLE: Set to one in the ISR every time 10
 alarm_toggle: dbit 1 ; turn on/off alarm -- initialize it to 0 in main
 alarm_AMPM_toggle: dbit 1 ; 0 = AM, 1 = PM
 clock_AMPM_toggle: dbit 1 ; 0 = AM, 1 = PM
+trim_mode: dbit 1 ; Buttons set the trim, line 2 shows it
+trim_neg: dbit 1 ; 0 = trim speeds the clock up, 1 = slows it down
+trim_dirty: dbit 1 ; Trim changed since line 2 last showed it
+ringing: dbit 1 ; An alarm is ringing
+alarm_edit: dbit 1 ; A button changed alarm_hours etc., the table is behind
+clock_edit: dbit 1 ; A button set the clock
+new_day: dbit 1 ; Set at midnight
+find_next: dbit 1 ; next_key is out of date
+key_pm: dbit 1 ; PM, for Key_Of
+alarm_stopped: dbit 1 ; This ALARM press stopped the alarm, and does nothing else
+melody_on: dbit 1 ; Melody_Step is playing
+melody_once: dbit 1 ; ... to its end, not looped
+t2_timed: dbit 1 ; Timer2_ISR started Timer0 (the main loop was idle)
+stats_ready: dbit 1 ; stats has a new second for Stats_Send
 
 
 ;-----------------------CODE SEGMENT----------------------------------------------------------;
@@ -93,46 +230,136 @@ $include(LCD_4bit.inc) ; A library of LCD related functions and utility macros
 $LIST
 
 ;                     1234567890123456    <- This helps determine the location of the counter
-Initial_time:  db 'Time  12:00:00', 0
-Alarm_time:    db 'Alarm 12:00', 0
+Initial_time:  db 'Sun   12:00:00', 0
+Alarm_time:    db '1 12:00AM D5 OFF', 0
 alarm_on:      db ' ON', 0
 alarm_off:     db 'OFF', 0
 clock_AM:      db 'AM',0
 clock_PM:      db 'PM',0
 alarm_AM:      db 'AM', 0
 alarm_PM:      db 'PM', 0
+Trim_label:    db 'Trim +000 ppm M1', 0
+Day_names:     db 'SunMonTueWedThuFriSat'
+Day_bits:      db 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40
+Repeat_days:   db 0x7F, 0x7F, 0x3E, 0x41 ; Once, daily, Mon-Fri, Sat+Sun
+Repeat_chars:  db 'ODWS'
+Notes:         db high(NOTE_BEEP), low(NOTE_BEEP), high(NOTE_G5), low(NOTE_G5)
+               db high(NOTE_C6), low(NOTE_C6), high(NOTE_D6), low(NOTE_D6)
+               db high(NOTE_E6), low(NOTE_E6), high(NOTE_G6), low(NOTE_G6)
+               db high(NOTE_C7), low(NOTE_C7)
+Melodies:
+Melody_beep:   db N_BEEP, 100, 0, 100, MEL_END ; As before: 1s on, 1s off
+Melody_pips:   db N_BEEP, 8, 0, 8, N_BEEP, 8, 0, 8, N_BEEP, 8, 0, 8, N_BEEP, 8, 0, 60, MEL_END
+Melody_rise:   db N_C6, 15, N_E6, 15, N_G6, 15, N_C7, 30, 0, 50, MEL_END
+Melody_chime:  db N_E6, 40, N_C6, 40, N_D6, 40, N_G5, 80, 0, 40
+               db N_G5, 40, N_D6, 40, N_E6, 40, N_C6, 80, 0, 100, MEL_END
+Melody_offsets: db Melody_beep-Melodies, Melody_pips-Melodies, Melody_rise-Melodies, Melody_chime-Melodies
+; The stats line: characters, or 0x80 + n for nibble n of stats (high first)
+Stats_format:  db 'w', 0x80, 0x81, 0x82, 0x83, ' b', 0x84, 0x85
+               db ' a', 0x86, 0x87, 0x88, 0x89, 0x8A, 0x8B, 13, 10, 0
 
 ;---------------------------------;
-; Routine to initialize the ISR   ;
-; for timer 0                     ;
+; PWM2 on P0.5 for the speaker,   ;
+; running from here on, silent    ;
+; until Tone_Set gives it a note  ;
 ;---------------------------------;
-Timer0_Init:
-    orl CKCON, #0b00001000 ; Input for timer 0 is sysclk/1
-    mov a, TMOD
-    anl a, #0xf0 ; 11110000 Clear the bits for timer 0
-    orl a, #0x01 ; 00000001 Configure timer 0 as 16-timer
-    mov TMOD, a
-    mov TH0, #high(TIMER0_RELOAD)
-    mov TL0, #low(TIMER0_RELOAD)
-    ; Enable the timer and interrupts
-    setb ET0  ; Enable timer 0 interrupt
-    setb TR0  ; Start timer 0
+Pwm_Init:
+    anl     CKCON, #0b10111111 ; PWMCKS = 0: the PWM runs from Fsys
+    mov     PWMCON1, #0x03 ; Edge aligned, independent, Fsys/8
+    mov     PWMPH, #high(NOTE_BEEP)
+    mov     PWMPL, #low(NOTE_BEEP)
+    mov     PWM2H, #0
+    mov     PWM2L, #0
+    mov     TA, #0xAA
+    mov     TA, #0x55
+    mov     SFRS, #0x01 ; PIOCON1 is on SFR page 1
+    orl     PIOCON1, #0x04 ; PWM2 out on P0.5
+    mov     TA, #0xAA
+    mov     TA, #0x55
+    mov     SFRS, #0x00
+    orl     PWMCON0, #0xC0 ; PWMRUN, LOAD
     ret
 
-;---------------------------------;
-; ISR for timer 0.  Set to execute;
-; every 1/4096Hz to generate a    ;
-; 2048 Hz wave at pin SOUND_OUT   ;
-;---------------------------------;
-Timer0_ISR:
-    ;clr TF0  ; According to the data sheet this is done for us already.
-    ; Timer 0 doesn't have 16-bit auto-reload, so
-    clr TR0
-    mov TH0, #high(TIMER0_RELOAD)
-    mov TL0, #low(TIMER0_RELOAD)
-    setb TR0
-    cpl SOUND_OUT ; Connect speaker the pin assigned to 'SOUND_OUT'!
-    reti
+; PWM2 to note a of Notes, half duty, or silent (duty 0) for a = 0.  LOAD
+; makes the change at the end of the period playing.  Uses r4, dptr.
+Tone_Set:
+    jz      Tone_Set_rest
+    dec     a
+    rl      a
+    mov     r4, a
+    mov     dptr, #Notes
+    movc    a, @a+dptr
+    mov     PWMPH, a
+    clr     c
+    rrc     a
+    mov     PWM2H, a
+    mov     a, r4
+    inc     a
+    movc    a, @a+dptr
+    mov     PWMPL, a
+    rrc     a ; With the bit out of the high byte: duty = period / 2
+    mov     PWM2L, a
+    orl     PWMCON0, #0x40 ; LOAD
+    ret
+Tone_Set_rest:
+    mov     PWM2H, #0
+    mov     PWM2L, #0
+    orl     PWMCON0, #0x40 ; LOAD
+    ret
+
+; Play melody a, looped, or once with melody_once
+Melody_Start:
+    clr     melody_on
+    mov     dptr, #Melody_offsets
+    movc    a, @a+dptr
+    mov     mel_pos, a
+    mov     note_left, #1 ; The next 10ms step plays the first note
+    setb    melody_on
+    ret
+
+Melody_Stop:
+    clr     melody_on
+    clr     a
+    ljmp    Tone_Set
+
+; Every 10ms from Timer2_ISR, in register bank 1: the next note once the
+; one playing is over.  The PWM plays it with no CPU time at all.
+Melody_Step:
+    jnb     melody_on, Melody_Step_done
+    djnz    note_left, Melody_Step_done
+    push    dpl
+    push    dph
+Melody_Step_note:
+    mov     dptr, #Melodies
+    mov     a, mel_pos
+    movc    a, @a+dptr
+    cjne    a, #MEL_END, Melody_Step_play
+    jb      melody_once, Melody_Step_off
+    mov     a, melody ; Again from the top
+    mov     dptr, #Melody_offsets
+    movc    a, @a+dptr
+    mov     mel_pos, a
+    sjmp    Melody_Step_note
+Melody_Step_off:
+    clr     melody_on
+    clr     a
+    lcall   Tone_Set
+    sjmp    Melody_Step_pop
+Melody_Step_play:
+    mov     r5, a ; The note
+    mov     a, mel_pos
+    inc     a
+    movc    a, @a+dptr
+    mov     note_left, a
+    inc     mel_pos
+    inc     mel_pos
+    mov     a, r5
+    lcall   Tone_Set
+Melody_Step_pop:
+    pop     dph
+    pop     dpl
+Melody_Step_done:
+    ret
 
 ;---------------------------------;
 ; Routine to initialize the ISR   ;
@@ -151,7 +378,7 @@ Timer2_Init:
     mov     Count1ms+0, a
     mov     Count1ms+1, a
     ; Enable the timer and interrupts
-    orl     EIE, #0b10000010B ; Enable timer 2 interrupt ET2=1 AND enable pin interrupt: EPI = 1
+    orl     EIE, #0b10000000B ; Enable timer 2 interrupt ET2=1
 
     setb    TR2  ; Enable timer 2
     ret
@@ -159,10 +386,19 @@ Timer2_Init:
 ; ----------------------------------------TIMER 2 ISR---------------------------------------;
 Timer2_ISR:
     clr TF2  ; Timer 2 doesn't clear TF2 automatically. Do it in the ISR.  It is bit addressable.
+    jb TR0, Timer2_ISR_timed ; Timer0 counts the active time: the ISR's too
+    setb TR0
+    setb t2_timed
+Timer2_ISR_timed:
     
     ; The two registers used in the ISR must be saved in the stack
     push acc
     push psw
+    mov psw, #0x08 ; Register bank 1, for Buttons_Sample and Melody_Step
+    lcall Buttons_Sample ; r7 = 1 on a 10ms step
+    cjne r7, #1, Timer2_ISR_ms
+    lcall Melody_Step
+Timer2_ISR_ms:
     
     ; Increment the 16-bit one mili second counter
     inc Count1ms+0    ; Increment the low 8-bits first
@@ -179,11 +415,31 @@ Inc_Done:
     
     ; 1000 milliseconds have passed.  Set a flag so the main program knows
     setb seconds_flag ; Let the main program know half second had passed
-    cpl TR0 ; Enable/disable timer/counter 0. This line creates a beep-silence-beep-silence sound.
+    lcall Stats_Second
     ; Reset to zero the milli-seconds counter, it is a 16-bit variable
     clr a
     mov Count1ms+0, a
     mov Count1ms+1, a
+    ; Trim: 1 ppm is 1us a second.  Once the seconds have been owed 1000us
+    ; (one tick), the next second is 999 ticks (count from 1) to speed the
+    ; clock up or 1001 (count from -1) to slow it down.
+    mov a, trim_acc+0
+    add a, trim+0
+    da  a
+    mov trim_acc+0, a
+    mov a, trim_acc+1
+    addc a, trim+1
+    da  a
+    mov trim_acc+1, a
+    clr c
+    subb a, #0x10 ; 1000 in BCD
+    jc  trim_done
+    mov trim_acc+1, a
+    mov Count1ms+0, #0x01
+    jnb trim_neg, trim_done
+    mov Count1ms+0, #0xFF
+    mov Count1ms+1, #0xFF
+trim_done:
     ; Increment the BCD counter
     mov a, seconds
     jnb UPDOWN, Timer2_ISR_decrement
@@ -216,6 +472,8 @@ Timer2_ISR_da:
     ; Flip AM/PM when moving 11 -> 12
     cjne a, #0x12, check_13_auto
     cpl clock_AMPM_toggle
+    jb clock_AMPM_toggle, check_13_auto ; Noon
+    lcall Next_Day ; Midnight
     
 check_13_auto:
     cjne a, #0x13, seconds_done
@@ -224,19 +482,280 @@ check_13_auto:
 seconds_done:
     
 Timer2_ISR_done:
+    jnb t2_timed, Timer2_ISR_pop
+    clr TR0 ; Back to idle
+    clr t2_timed
+Timer2_ISR_pop:
     pop psw
     pop acc
     reti
 
 
-;-----------------------HOURS BUTTON ISR-----------------------;
-HOURS_ISR:
-    push    ACC
-    push    psw
+;-----------------------DUTY CYCLE-----------------------------;
+; Timer0 counts Fsys/12 while the CPU is not idle: the main loop starts it
+; on waking and stops it to idle, Timer2_ISR runs it while it lands in idle.
+Timer0_Init:
+    anl     CKCON, #0b11110111 ; T0M = 0: Fsys/12
+    mov     a, TMOD
+    anl     a, #0xf0
+    orl     a, #0x01 ; 16-bit, no reload
+    mov     TMOD, a
+    clr     a
+    mov     TH0, a
+    mov     TL0, a
+    mov     t0_over, a
+    mov     wakes+0, a
+    mov     wakes+1, a
+    mov     busy_passes, a
+    mov     stats_pos, a
+    clr     stats_ready
+    clr     t2_timed
+    setb    ET0
+    setb    TR0 ; The main loop is running
+    ret
+
+; Every 47ms of active time
+Timer0_ISR:
+    inc     t0_over
+    reti
+
+; UART0 for the stats line, transmit only.  Timer1 makes the baud rate.
+Uart_Init:
+    mov     SCON, #0x42 ; Mode 1, 8N1, TI set: ready to send
+    orl     PCON, #0x80 ; SMOD: baud = Fsys / 16 / (256 - TH1)
+    orl     CKCON, #0b00010000 ; T1M = 1: Timer1 from Fsys
+    mov     a, TMOD
+    anl     a, #0x0f
+    orl     a, #0x20 ; Timer1 8-bit auto-reload
+    mov     TMOD, a
+    mov     TH1, #TIMER1_RELOAD
+    mov     TL1, #TIMER1_RELOAD
+    setb    TR1
+    ret
+
+; Once a second from Timer2_ISR, with Timer0 running: the second's counts
+; to stats for Stats_Send, and a new second
+Stats_Second:
+    clr     TR0
+    jbc     TF0, Stats_Second_over ; An overflow Timer0_ISR has yet to count
+    sjmp    Stats_Second_copy
+Stats_Second_over:
+    inc     t0_over
+Stats_Second_copy:
+    mov     stats+0, wakes+1
+    mov     stats+1, wakes+0
+    mov     stats+2, busy_passes
+    mov     stats+3, t0_over
+    mov     stats+4, TH0
+    mov     stats+5, TL0
+    clr     a
+    mov     TH0, a
+    mov     TL0, a
+    mov     t0_over, a
+    mov     wakes+0, a
+    mov     wakes+1, a
+    mov     busy_passes, a
+    setb    TR0
+    setb    stats_ready
+    ret
 
+; From the main loop: the next character of the stats line if the UART is
+; free, so sending it never waits.  Uses r0, dptr.
+Stats_Send:
+    jnb     TI, Stats_Send_done
+    mov     a, stats_pos
+    jnz     Stats_Send_next
+    jnb     stats_ready, Stats_Send_done ; No line going out, and no new one
+    clr     stats_ready
+Stats_Send_next:
+    mov     dptr, #Stats_format
+    movc    a, @a+dptr
+    jz      Stats_Send_end
+    jnb     acc.7, Stats_Send_put
+    anl     a, #0x7F ; Nibble n: byte n/2, low nibble for odd n
+    clr     c
+    rrc     a
+    jc      Stats_Send_low
+    add     a, #stats
+    mov     r0, a
+    mov     a, @r0
+    swap    a
+    sjmp    Stats_Send_hex
+Stats_Send_low:
+    add     a, #stats
+    mov     r0, a
+    mov     a, @r0
+Stats_Send_hex:
+    anl     a, #0x0F
+    cjne    a, #10, $+3 ; c = a < 10
+    jc      Stats_Send_digit
+    add     a, #('A'-'0'-10)
+Stats_Send_digit:
+    add     a, #'0'
+Stats_Send_put:
+    clr     TI
+    mov     SBUF, a
+    inc     stats_pos
+Stats_Send_done:
+    ret
+Stats_Send_end:
+    mov     stats_pos, #0
+    ret
+
+;-----------------------BUTTONS--------------------------------;
+; Once a millisecond from Timer2_ISR, in register bank 1.  Each button has
+; an integrator, btn_count, that counts up to DEBOUNCE_MS while the pin is
+; low and down to 0 while it is high.  The button is pressed from reaching
+; DEBOUNCE_MS until back at 0, so contact bounce never changes its state
+; and never costs more than this.  While pressed, btn_time counts 10ms
+; steps for the hold and repeat events.
+Buttons_Sample:
+    clr     a ; Buttons down, bit BTN_x
+    mov     c, ALARM_BUTTON
+    cpl     c
+    mov     acc.0, c
+    mov     c, AMPM_BUTTON
+    cpl     c
+    mov     acc.1, c
+    mov     c, CLEAR_BUTTON
+    cpl     c
+    mov     acc.2, c
+    mov     c, HOURS_BUTTON
+    cpl     c
+    mov     acc.3, c
+    mov     c, MINUTES_BUTTON
+    cpl     c
+    mov     acc.4, c
+    mov     c, SECONDS_BUTTON
+    cpl     c
+    mov     acc.5, c
+    mov     r2, a
+    mov     r7, #0
+    djnz    btn_tick, Buttons_Sample_each
+    mov     btn_tick, #10
+    mov     r7, #1 ; A 10ms step
+Buttons_Sample_each:
+    mov     r0, #btn_count
+    mov     r3, #0 ; BTN_x
+    mov     r6, #1 ; Its bit
+Buttons_Sample_loop:
+    mov     a, r0
+    add     a, #BUTTONS
+    mov     r1, a ; -> btn_time
+    mov     a, r2
+    rrc     a
+    mov     r2, a
+    lcall   Button_Step
+    inc     r0
+    inc     r3
+    mov     a, r6
+    rl      a
+    mov     r6, a
+    cjne    r3, #BUTTONS, Buttons_Sample_loop
+    ret
+
+; Button r3 (bit r6), r0 -> its btn_count, r1 -> its btn_time, c = down
+Button_Step:
+    mov     a, @r0
+    jnc     Button_Step_up
+    cjne    a, #DEBOUNCE_MS, Button_Step_down
+    sjmp    Button_Step_held
+Button_Step_down:
+    inc     a
+    mov     @r0, a
+    cjne    a, #DEBOUNCE_MS, Button_Step_done
+    mov     a, @r1
+    jnz     Button_Step_done ; Still pressed from before
+    mov     @r1, #1
+    mov     a, r3
+    ljmp    Button_Put ; EV_PRESS
+Button_Step_up:
+    jz      Button_Step_done
+    dec     a
+    mov     @r0, a
+    jnz     Button_Step_done
+    mov     a, @r1
+    jz      Button_Step_done
+    mov     @r1, #0
+    mov     r4, a ; Steps it was held
+    mov     a, r3
+    lcall   Button_Hold_Of
+    jz      Button_Step_done ; No hold time: the press was the event
+    mov     r5, a
+    clr     c
+    mov     a, r4
+    subb    a, r5
+    jnc     Button_Step_done ; Held past it: the hold was the event
+    mov     a, r3
+    orl     a, #EV_RELEASE
+    ljmp    Button_Put
+Button_Step_held:
+    cjne    r7, #1, Button_Step_done
+    mov     a, @r1
+    cjne    a, #255, Button_Step_time
+    ret
+Button_Step_time:
+    inc     a
+    mov     @r1, a
+    mov     r4, a
+    mov     a, r3
+    lcall   Button_Hold_Of
+    jz      Button_Step_repeat
+    xrl     a, r4
+    jnz     Button_Step_done
+    mov     a, r3
+    orl     a, #EV_HOLD
+    ljmp    Button_Put
+Button_Step_repeat:
+    mov     a, r6
+    anl     a, #REPEAT_BUTTONS
+    jz      Button_Step_done
+    mov     a, r4
+    cjne    a, #REPEAT_FIRST, Button_Step_done
+    mov     @r1, #REPEAT_FIRST-REPEAT_RATE
+    mov     a, r3
+    ljmp    Button_Put ; EV_PRESS again
+Button_Step_done:
+    ret
+
+; a = the hold time of button a in 10ms steps, 0 for none.  movc @a+pc
+; leaves dptr alone for the main loop.
+Button_Hold_Of:
+    inc     a ; Over the ret
+    movc    a, @a+pc
+    ret
+    db      SELECT_HOLD, 0, TRIM_HOLD, 0, 0, 0
+
+; Queue event a; dropped if the queue is full.  Uses r1, r5.
+Button_Put:
+    mov     r5, a
+    mov     a, btn_head
+    add     a, #btn_queue
+    mov     r1, a
+    mov     a, btn_head
+    inc     a
+    anl     a, #BTN_QUEUE_LEN-1
+    cjne    a, btn_tail, Button_Put_room
+    ret
+Button_Put_room:
+    xch     a, r5 ; r5 = the new btn_head
+    mov     @r1, a
+    mov     btn_head, r5
+    ret
+
+
+;-----------------------HOURS BUTTON---------------------------;
+Hours_Press:
+    jnb     trim_mode, hours_not_trim
+    mov     a, #0x10 ; trim mode: +10 ppm
+    ljmp    Trim_Add
+
+hours_not_trim:
     ; check if we're modifying alarm_hours or not 
     jb      alarm_toggle, alarm_hours_routine ; if alarm_toggle = 1, go do the alarm hours routine
-    ; this ISR will set the hours
+    ; set the hours, with Timer2_ISR held off as it moves them too
+    setb    clock_edit
+    clr     EA
     mov     a, hours
     add     a, #0x01
     da      a
@@ -246,11 +765,14 @@ HOURS_ISR:
     cpl     clock_AMPM_toggle
 
 clock_13_man:
-    cjne    a, #0x13, HOURS_ISR_done ; if hours == 13, we've rolled over so reset to 1
+    cjne    a, #0x13, clock_hours_done ; if hours == 13, we've rolled over so reset to 1
     mov     hours, #0x01
-    sjmp    HOURS_ISR_done
+clock_hours_done:
+    setb    EA
+    ret
 
 alarm_hours_routine:
+    setb    alarm_edit
     mov     a, alarm_hours
     add     a, #0x01
     da      a
@@ -260,14 +782,609 @@ alarm_hours_routine:
     cpl     alarm_AMPM_toggle
 
 alarm_13_man:
-    cjne    a, #0x13, HOURS_ISR_done
+    cjne    a, #0x13, alarm_hours_done
     mov     alarm_hours, #0x01
+alarm_hours_done:
+    ret
 
-HOURS_ISR_done:
-    pop psw
-    pop ACC
-    reti
 
+;-----------------------CLOCK TRIM-----------------------------;
+; trim += a (BCD), 999 wraps to 000, for the hours and minutes buttons.
+; Timer2_ISR reads both bytes, so it waits until they are written.
+Trim_Add:
+    clr     EA
+    add     a, trim+0
+    da      a
+    mov     trim+0, a
+    mov     a, trim+1
+    addc    a, #0x00
+    da      a
+    cjne    a, #0x10, Trim_Add_done
+    clr     a
+Trim_Add_done:
+    mov     trim+1, a
+    setb    EA
+    setb    trim_dirty
+    setb    seconds_flag ; Show it now
+    ret
+
+; The saved trim and melody, or none if the page has never been written
+Trim_Load:
+    clr     a
+    mov     trim+0, a
+    mov     trim+1, a
+    mov     trim_acc+0, a
+    mov     trim_acc+1, a
+    mov     melody, a
+    clr     trim_neg
+    mov     dptr, #TRIM_FLASH
+    movc    a, @a+dptr
+    cjne    a, #TRIM_MAGIC, Trim_Load_done
+    mov     a, #1
+    movc    a, @a+dptr
+    mov     trim+0, a
+    mov     a, #2
+    movc    a, @a+dptr
+    mov     trim+1, a
+    mov     a, #3
+    movc    a, @a+dptr
+    mov     c, acc.0
+    mov     trim_neg, c
+    mov     a, #4
+    movc    a, @a+dptr
+    cjne    a, #MELODY_COUNT, $+3 ; c = a < MELODY_COUNT
+    jnc     Trim_Load_done ; Saved before there were melodies
+    mov     melody, a
+Trim_Load_done:
+    ret
+
+; Start the IAP command set up in IAPCN/IAPAH/IAPAL/IAPFD.  IAPTRG is
+; TA protected: the two TA writes must come right before it.
+Iap_Go:
+    mov     TA, #0xAA
+    mov     TA, #0x55
+    orl     IAPTRG, #0x01
+    ret
+
+; Erase the trim page and write the trim and melody, the magic byte last so a save
+; cut short reads as no trim.  The CPU stops for the erase (~5ms), which
+; costs the clock those timer ticks once per save.
+Trim_Save:
+    push    IE
+    clr     EA ; TA sequences must not be interrupted
+    mov     TA, #0xAA
+    mov     TA, #0x55
+    orl     CHPCON, #0x01 ; IAPEN
+    mov     TA, #0xAA
+    mov     TA, #0x55
+    orl     IAPUEN, #0x01 ; APUEN: APROM can be written
+
+    mov     IAPAH, #high(TRIM_FLASH)
+    mov     IAPAL, #low(TRIM_FLASH)
+    mov     IAPFD, #0xFF
+    mov     IAPCN, #IAP_ERASE
+    lcall   Iap_Go
+
+    mov     IAPCN, #IAP_PROGRAM
+    mov     IAPAL, #low(TRIM_FLASH+1)
+    mov     IAPFD, trim+0
+    lcall   Iap_Go
+    mov     IAPAL, #low(TRIM_FLASH+2)
+    mov     IAPFD, trim+1
+    lcall   Iap_Go
+    clr     a
+    mov     c, trim_neg
+    mov     acc.0, c
+    mov     IAPAL, #low(TRIM_FLASH+3)
+    mov     IAPFD, a
+    lcall   Iap_Go
+    mov     IAPAL, #low(TRIM_FLASH+4)
+    mov     IAPFD, melody
+    lcall   Iap_Go
+    mov     IAPAL, #low(TRIM_FLASH)
+    mov     IAPFD, #TRIM_MAGIC
+    lcall   Iap_Go
+
+    mov     TA, #0xAA
+    mov     TA, #0x55
+    anl     IAPUEN, #0xFE
+    mov     TA, #0xAA
+    mov     TA, #0x55
+    anl     CHPCON, #0xFE
+    pop     IE
+    ret
+
+; Line 2 in trim mode: "Trim +023 ppm M1"
+Display_Trim:
+    Set_Cursor(2, 6)
+    mov     lcd_char, #'+'
+    jnb     trim_neg, Display_Trim_sign
+    mov     lcd_char, #'-'
+Display_Trim_sign:
+    Display_char(lcd_char)
+    mov     a, trim+1
+    orl     a, #0x30
+    mov     lcd_char, a
+    Display_char(lcd_char)
+    Display_BCD(trim+0)
+    Set_Cursor(2, 16)
+    mov     a, melody
+    add     a, #'1'
+    mov     lcd_char, a
+    Display_char(lcd_char)
+    ret
+
+; Trim mode on or off; off saves the trim and puts the alarm back on line 2
+Trim_Mode_Toggle:
+    cpl     trim_mode
+    jnb     trim_mode, trim_mode_off
+    Set_Cursor(2, 1)
+    Send_Constant_String(#Trim_label)
+    setb    trim_dirty
+    ret
+trim_mode_off:
+    lcall   Trim_Save
+    Set_Cursor(2, 1)
+    Send_Constant_String(#Alarm_time)
+    ljmp    Alarm_Line_Stale ; The label wrote over the alarm
+
+
+;-----------------------ALARMS---------------------------------;
+; The clock and the alarms are compared as minutes since midnight: the
+; clock's (now_key) once a minute, and the earliest alarm still to come
+; today (next_key) whenever an alarm, the clock or the day changes.  Once a
+; second that leaves one 16-bit compare however many alarms are on.
+
+; Past midnight: the next day of the week.  Called from Timer2_ISR, or
+; with it held off.
+Next_Day:
+    push    acc
+    inc     weekday
+    mov     a, weekday
+    cjne    a, #7, Next_Day_done
+    mov     weekday, #0
+Next_Day_done:
+    setb    new_day
+    pop     acc
+    ret
+
+; a: BCD 00-99 to binary.  Uses b, r3.
+Bcd_Bin:
+    mov     r3, a
+    anl     a, #0x0F
+    xch     a, r3 ; r3 = units
+    swap    a
+    anl     a, #0x0F
+    mov     b, #10
+    mul     ab
+    add     a, r3
+    ret
+
+; r4 (hours, BCD 1-12), r5 (minutes, BCD) and key_pm to minutes since
+; midnight in r4:r5 (high:low).  12AM is 0, 12PM 720.  Uses b, r3.
+Key_Of:
+    mov     a, r4
+    lcall   Bcd_Bin
+    cjne    a, #12, Key_Of_hour
+    clr     a
+Key_Of_hour:
+    jnb     key_pm, Key_Of_am
+    add     a, #12
+Key_Of_am:
+    mov     b, #60
+    mul     ab
+    mov     r4, b
+    xch     a, r5 ; r5 = hours x 60, low byte
+    lcall   Bcd_Bin
+    add     a, r5
+    mov     r5, a
+    clr     a
+    addc    a, r4
+    mov     r4, a
+    ret
+
+; r0 -> the entry of alarm_sel
+Alarm_Ptr:
+    mov     a, alarm_sel
+    rl      a
+    rl      a
+    add     a, #alarm_table
+    mov     r0, a
+    ret
+
+; alarm_hours etc., which the buttons edit, into the table and back
+Alarm_Store:
+    lcall   Alarm_Ptr
+    mov     @r0, alarm_hours
+    inc     r0
+    mov     @r0, alarm_minutes
+    inc     r0
+    mov     a, alarm_repeat
+    rl      a
+    rl      a
+    mov     c, alarm_AMPM_toggle
+    mov     acc.1, c ; ALM_PM
+    mov     c, alarm_toggle
+    mov     acc.0, c ; ALM_ON
+    mov     @r0, a
+    inc     r0
+    mov     @r0, alarm_snooze
+    ret
+
+Alarm_Load:
+    lcall   Alarm_Ptr
+    mov     alarm_hours, @r0
+    inc     r0
+    mov     alarm_minutes, @r0
+    inc     r0
+    mov     a, @r0
+    mov     c, acc.0
+    mov     alarm_toggle, c
+    mov     c, acc.1
+    mov     alarm_AMPM_toggle, c
+    rr      a
+    rr      a
+    anl     a, #0x03
+    mov     alarm_repeat, a
+    inc     r0
+    mov     alarm_snooze, @r0
+    ret
+
+; The next alarm on line 2 (ALARM held)
+Alarm_Select:
+    lcall   Alarm_Store
+    mov     a, alarm_sel
+    inc     a
+    anl     a, #ALARMS-1
+    mov     alarm_sel, a
+    lcall   Alarm_Load
+    setb    seconds_flag ; Show it now
+    ret
+
+; r4:r5 (high:low), alarm r3 (0xFF: the snooze), is the next alarm if it
+; is at or after r6:r7 and before next_key
+Alarm_Consider:
+    clr     c
+    mov     a, r5
+    subb    a, r7
+    mov     a, r4
+    subb    a, r6
+    jc      Alarm_Consider_done
+    clr     c
+    mov     a, r5
+    subb    a, next_key+0
+    mov     a, r4
+    subb    a, next_key+1
+    jnc     Alarm_Consider_done
+    mov     next_key+0, r5
+    mov     next_key+1, r4
+    mov     next_slot, r3
+Alarm_Consider_done:
+    ret
+
+; next_key: the earliest alarm after this minute, which has rung
+Alarm_Next_After:
+    mov     a, now_key+0
+    add     a, #1
+    mov     r7, a
+    clr     a
+    addc    a, now_key+1
+    mov     r6, a
+; next_key: the earliest alarm on today at or after r6:r7, or the snooze.
+; A snooze past midnight is a small key, found once the day has changed.
+Alarm_Next:
+    mov     next_key+0, #0xFF
+    mov     next_key+1, #0xFF
+    mov     r5, snooze_key+0
+    mov     r4, snooze_key+1
+    mov     r3, #0xFF
+    lcall   Alarm_Consider
+    mov     a, weekday
+    mov     dptr, #Day_bits
+    movc    a, @a+dptr
+    mov     r2, a
+    mov     r0, #alarm_table
+    mov     r1, #ALARMS
+Alarm_Next_loop:
+    mov     a, @r0
+    mov     r4, a
+    inc     r0
+    mov     a, @r0
+    mov     r5, a
+    inc     r0
+    mov     a, @r0 ; Flags
+    inc     r0
+    inc     r0
+    jnb     acc.0, Alarm_Next_skip ; ALM_ON
+    mov     c, acc.1
+    mov     key_pm, c
+    rr      a
+    rr      a
+    anl     a, #0x03
+    mov     dptr, #Repeat_days
+    movc    a, @a+dptr
+    anl     a, r2
+    jz      Alarm_Next_skip ; Not today
+    lcall   Key_Of
+    mov     a, #ALARMS
+    clr     c
+    subb    a, r1
+    mov     r3, a
+    lcall   Alarm_Consider
+Alarm_Next_skip:
+    djnz    r1, Alarm_Next_loop
+    ret
+
+; Once a second from the main loop: now_key when the minute changes or
+; the clock is set, next_key when an alarm, the clock or the day changes
+Alarm_Update:
+    jnb     alarm_edit, Alarm_Update_clock
+    clr     alarm_edit
+    lcall   Alarm_Store
+    setb    find_next
+Alarm_Update_clock:
+    jbc     clock_edit, Alarm_Update_set
+    mov     a, minutes
+    cjne    a, key_minutes, Alarm_Update_key
+    sjmp    Alarm_Update_next
+Alarm_Update_set:
+    setb    find_next ; The next alarm may be behind the clock now
+Alarm_Update_key:
+    clr     EA ; hours, minutes and AM/PM of the same minute
+    mov     r4, hours
+    mov     r5, minutes
+    mov     c, clock_AMPM_toggle
+    setb    EA
+    mov     key_minutes, r5
+    mov     key_pm, c
+    lcall   Key_Of
+    mov     now_key+0, r5
+    mov     now_key+1, r4
+    clr     ringing ; An alarm rings for its minute only
+Alarm_Update_next:
+    jbc     new_day, Alarm_Update_find
+    jbc     find_next, Alarm_Update_find
+    ret
+Alarm_Update_find:
+    clr     find_next
+    mov     r7, now_key+0
+    mov     r6, now_key+1
+    ljmp    Alarm_Next
+
+; now_key = next_key: ring, turn a one-off alarm off, and find the next
+Alarm_Fire:
+    setb    ringing
+    mov     a, next_slot
+    cjne    a, #0xFF, Alarm_Fire_slot
+    mov     snooze_key+0, #0xFF ; The snooze is used up
+    mov     snooze_key+1, #0xFF
+    sjmp    Alarm_Fire_next
+Alarm_Fire_slot:
+    mov     ring_slot, a
+    rl      a
+    rl      a
+    add     a, #alarm_table+2
+    mov     r0, a
+    mov     a, @r0 ; Flags
+    anl     a, #ALM_REPEAT
+    jnz     Alarm_Fire_next
+    mov     a, @r0
+    clr     acc.0 ; ALM_ON
+    mov     @r0, a
+    mov     a, ring_slot
+    cjne    a, alarm_sel, Alarm_Fire_next
+    clr     alarm_toggle
+Alarm_Fire_next:
+    ljmp    Alarm_Next_After
+
+; AM/PM while ringing: ring again in the alarm's snooze minutes, or stop
+; if it has none
+Snooze_Start:
+    clr     ringing
+    mov     a, ring_slot
+    rl      a
+    rl      a
+    add     a, #alarm_table+3
+    mov     r0, a
+    mov     a, @r0
+    jz      Snooze_Start_done
+    add     a, now_key+0
+    mov     r5, a
+    clr     a
+    addc    a, now_key+1
+    mov     r4, a
+    clr     c ; Past midnight: that many minutes into tomorrow
+    mov     a, r5
+    subb    a, #low(1440)
+    mov     r3, a
+    mov     a, r4
+    subb    a, #high(1440)
+    jc      Snooze_Start_today
+    mov     r4, a
+    mov     a, r3
+    mov     r5, a
+Snooze_Start_today:
+    mov     snooze_key+0, r5
+    mov     snooze_key+1, r4
+    ljmp    Alarm_Next_After
+Snooze_Start_done:
+    ret
+
+
+;-----------------------DISPLAY--------------------------------;
+; Every field against what the LCD shows; only the ones that changed get
+; a cursor move and a write.  Most seconds that is the seconds alone:
+; 3 LCD writes instead of about 20.
+Display_Fields:
+    mov     a, weekday
+    cjne    a, shown_weekday, draw_weekday
+    sjmp    weekday_shown
+draw_weekday:
+    mov     shown_weekday, a
+    Set_Cursor(1, 1)
+    mov     a, weekday
+    mov     b, #3
+    mul     ab
+    mov     r3, a
+    mov     r4, #3
+draw_weekday_char:
+    mov     a, r3
+    mov     dptr, #Day_names
+    movc    a, @a+dptr
+    mov     lcd_char, a
+    Display_char(lcd_char)
+    inc     r3
+    djnz    r4, draw_weekday_char
+weekday_shown:
+
+    mov     a, hours
+    cjne    a, shown_hours, draw_hours
+    sjmp    hours_shown
+draw_hours:
+    mov     shown_hours, a
+    Set_Cursor(1, 7)
+    Display_BCD(hours)
+hours_shown:
+
+    mov     a, minutes
+    cjne    a, shown_minutes, draw_minutes
+    sjmp    minutes_shown
+draw_minutes:
+    mov     shown_minutes, a
+    Set_Cursor(1, 10)
+    Display_BCD(minutes)
+minutes_shown:
+
+    mov     a, seconds
+    cjne    a, shown_seconds, draw_seconds
+    sjmp    seconds_shown
+draw_seconds:
+    mov     shown_seconds, a
+    Set_Cursor(1, 13)
+    Display_BCD(seconds)
+seconds_shown:
+
+    clr     a
+    mov     c, clock_AMPM_toggle
+    rlc     a
+    cjne    a, shown_clock_AMPM, draw_clock_AMPM
+    sjmp    clock_AMPM_shown
+draw_clock_AMPM:
+    mov     shown_clock_AMPM, a
+    Set_Cursor(1, 15)
+    jb      clock_AMPM_toggle, show_clock_pm_str
+    Send_Constant_String(#clock_AM)
+    sjmp    clock_AMPM_shown
+show_clock_pm_str:
+    Send_Constant_String(#clock_PM)
+clock_AMPM_shown:
+
+    ; Line 2: the trim in trim mode, else the alarm
+    jnb     trim_mode, display_alarm_fields
+    jnb     trim_dirty, trim_shown
+    clr     trim_dirty
+    lcall   Display_Trim
+trim_shown:
+    ret
+
+display_alarm_fields:
+    mov     a, alarm_sel
+    cjne    a, shown_alarm_sel, draw_alarm_sel
+    sjmp    alarm_sel_shown
+draw_alarm_sel:
+    mov     shown_alarm_sel, a
+    Set_Cursor(2, 1)
+    mov     a, alarm_sel
+    add     a, #'1'
+    mov     lcd_char, a
+    Display_char(lcd_char)
+alarm_sel_shown:
+
+    mov     a, alarm_hours
+    cjne    a, shown_alarm_hours, draw_alarm_hours
+    sjmp    alarm_hours_shown
+draw_alarm_hours:
+    mov     shown_alarm_hours, a
+    Set_Cursor(2, 3)
+    Display_BCD(alarm_hours)
+alarm_hours_shown:
+
+    mov     a, alarm_minutes
+    cjne    a, shown_alarm_minutes, draw_alarm_minutes
+    sjmp    alarm_minutes_shown
+draw_alarm_minutes:
+    mov     shown_alarm_minutes, a
+    Set_Cursor(2, 6)
+    Display_BCD(alarm_minutes)
+alarm_minutes_shown:
+
+    mov     a, alarm_repeat
+    cjne    a, shown_alarm_repeat, draw_alarm_repeat
+    sjmp    alarm_repeat_shown
+draw_alarm_repeat:
+    mov     shown_alarm_repeat, a
+    Set_Cursor(2, 11)
+    mov     a, alarm_repeat
+    mov     dptr, #Repeat_chars
+    movc    a, @a+dptr
+    mov     lcd_char, a
+    Display_char(lcd_char)
+alarm_repeat_shown:
+
+    mov     a, alarm_snooze
+    cjne    a, shown_alarm_snooze, draw_alarm_snooze
+    sjmp    alarm_snooze_shown
+draw_alarm_snooze:
+    mov     shown_alarm_snooze, a
+    Set_Cursor(2, 12)
+    mov     a, alarm_snooze
+    orl     a, #0x30
+    mov     lcd_char, a
+    Display_char(lcd_char)
+alarm_snooze_shown:
+
+    clr     a
+    mov     c, alarm_toggle
+    rlc     a
+    cjne    a, shown_alarm_on, draw_alarm_on
+    sjmp    alarm_on_shown
+draw_alarm_on:
+    mov     shown_alarm_on, a
+    Set_Cursor(2, 14)
+    jb      alarm_toggle, show_alarm_on_str
+    Send_Constant_String(#alarm_off)
+    sjmp    alarm_on_shown
+show_alarm_on_str:
+    Send_Constant_String(#alarm_on)
+alarm_on_shown:
+
+    clr     a
+    mov     c, alarm_AMPM_toggle
+    rlc     a
+    cjne    a, shown_alarm_AMPM, draw_alarm_AMPM
+    sjmp    Display_Fields_done
+draw_alarm_AMPM:
+    mov     shown_alarm_AMPM, a
+    Set_Cursor(2, 8)
+    jb      alarm_AMPM_toggle, show_alarm_pm_str
+    Send_Constant_String(#alarm_AM)
+    ret
+show_alarm_pm_str:
+    Send_Constant_String(#alarm_PM)
+Display_Fields_done:
+    ret
+
+; None of line 2's alarm fields are known to be on the LCD
+Alarm_Line_Stale:
+    mov     a, #0xFF
+    mov     shown_alarm_sel, a
+    mov     shown_alarm_hours, a
+    mov     shown_alarm_minutes, a
+    mov     shown_alarm_AMPM, a
+    mov     shown_alarm_repeat, a
+    mov     shown_alarm_snooze, a
+    mov     shown_alarm_on, a
+    ret
 
 
 ;---------------------------------;
@@ -276,7 +1393,7 @@ HOURS_ISR_done:
 ; loop.                           ;
 ;---------------------------------;
 main:
-    mov         SP  , #0x7F
+    mov         SP  , #STACK_BASE-1
     mov         P0M1, #0x00
     mov         P0M2, #0x00
     mov         P1M1, #0x00
@@ -285,9 +1402,15 @@ main:
     mov         P3M1, #0x00
 	anl         P1M1, #01111110B 
     orl         P1M2, #10000001B
+    anl         P0M1, #11011111B
+    orl         P0M2, #00100000B ; P0.5 push-pull for the speaker
 
 
           
+    lcall Trim_Load
+    lcall Buttons_Init
+    lcall Pwm_Init
+    lcall Uart_Init
     lcall Timer0_Init
     lcall Timer2_Init
 
@@ -295,29 +1418,38 @@ main:
     mov         seconds         , #0x00
     mov         minutes         , #0x00
     mov         hours           , #0x12
-    mov         alarm_minutes   , #0x00
-    mov         alarm_hours     , #0x12
-    clr         alarm_toggle    ; Initialize edit mode bit to zero
-    clr         alarm_AMPM_toggle ; 0 = AM
     clr         clock_AMPM_toggle ; 0 = AM
+    mov         weekday         , #0
+
+    ; Every alarm 12:00 AM, off, daily
+    mov         r0, #alarm_table
+    mov         r1, #ALARMS
+init_alarms:
+    mov         @r0, #0x12
+    inc         r0
+    mov         @r0, #0x00
+    inc         r0
+    mov         @r0, #(REPEAT_DAILY*4)
+    inc         r0
+    mov         @r0, #SNOOZE_MIN
+    inc         r0
+    djnz        r1, init_alarms
+    mov         alarm_sel, #0
+    lcall       Alarm_Load
+    mov         a, #0xFF
+    mov         snooze_key+0, a
+    mov         snooze_key+1, a
+    mov         key_minutes, a ; Work out now_key and next_key first thing
+    clr         ringing
+    clr         alarm_edit
+    clr         clock_edit
+    clr         new_day
+    setb        find_next
    ; setb			555_rst			;, #0x00 ; extra feature!!!!!!!
    setb			P1.0
 
     setb EA   
 
-;----------------INITIALIZE EXTERNAL INTERRUPT 0-----------------;
-    setb EX0
-    setb IT0
-;----------------INITIALIZE PIN INTERRUPTS--------------;
-
-    ; pins .1, 2, 6
-    mov     PICON, #10011001B
-    mov     PINEN, #01000110B
-
-    orl     EIE, #00000010B
-
-
-
     lcall LCD_4BIT
     WriteCommand(#0x0C)
 
@@ -326,61 +1458,210 @@ main:
 
     Set_Cursor(2,1)
     Send_Constant_String(#Alarm_time)
-    Set_Cursor(2, 14)
-    Send_Constant_String(#alarm_off) ; Initial status
+    mov         a, #0xFF ; Nothing on the LCD is known to be up to date
+    mov         shown_weekday, a
+    mov         shown_hours, a
+    mov         shown_minutes, a
+    mov         shown_seconds, a
+    mov         shown_clock_AMPM, a
+    lcall       Alarm_Line_Stale
 
     setb seconds_flag
     mov seconds, #0x00
     
 
 loop:
+    lcall   Stats_Send
+    ; Timer2_ISR debounces the buttons: one event a pass, so the display and
+    ; the alarm never wait on a button
+    lcall   Button_Get
+    cjne    a, #0xFF, loop_event
+    jb      seconds_flag, loop_b
+    ; Nothing to do: idle until an interrupt, every 1ms from Timer2.  Work
+    ; posted between the checks above and here waits for the next one.
+    clr     TR0
+    orl     PCON, #0x01 ; IDL
+    setb    TR0
+    inc     wakes+0
+    mov     a, wakes+0
+    jnz     loop
+    inc     wakes+1
+    sjmp    loop
+loop_event:
+    lcall   Button_Event
+    setb    seconds_flag ; Show what it changed
+loop_a:
+    jb 		seconds_flag, loop_b  ; If flag is set, jump over the long jump to the display code
+    ljmp 	loop                ; Otherwise, use a Long Jump to reach the distant top
+loop_b:
 
+    clr 	seconds_flag     ; We clear this flag in the main loop, but it is set in the ISR for timer 2
+    inc     busy_passes
+    lcall   Alarm_Update
 
-;-------------------------------ALARM TOGGLE CHECK (polling)----------------------------------;
-alarm_check_routine:
-    ; toggle the edit mode bit. 
+;-----------------------ALARM COMPARISON-----------------------------------;
+; next_key is the earliest alarm to come (see ALARMS), so however many
+; are on this is one compare
+alarm_compare_logic_label:
+    mov         a, now_key+0
+    cjne        a, next_key+0, alarm_compared
+    mov         a, now_key+1
+    cjne        a, next_key+1, alarm_compared
+    lcall       Alarm_Fire
+alarm_compared:
+    lcall       Display_Fields
+    jnb         ringing, alarm_beep_stop
 
-    jb      ALARM_BUTTON, AMPM_check_routine 
-    Wait_Milli_Seconds(#50)
-    jb      ALARM_BUTTON, AMPM_check_routine
-    jnb     ALARM_BUTTON, $ ; wait for release
+start_the_beep:
+    jb          melody_on, beep_playing ; Already, or a preview to finish first
+    clr         melody_once
+    mov         a, melody
+    lcall       Melody_Start
+beep_playing:
+    setb        P1.0 ; Enable LED Blinker
+    ljmp        loop
 
-    cpl     alarm_toggle ; compliment the variable
-    
-    jb      alarm_toggle, show_alarm_on
-    Set_Cursor(2,14)
-    Send_Constant_String(#alarm_off)
-    sjmp    AMPM_check_routine
+alarm_beep_stop:  
+    jb          melody_once, beep_stopped ; A preview plays to its end
+    jnb         melody_on, beep_stopped
+    lcall       Melody_Stop
+beep_stopped:
+    clr         P1.0 ; Turn off LED Blinker
+    ljmp        loop
+        
+;-----------------------BUTTON EVENTS--------------------------;
+; Before Timer2_Init
+Buttons_Init:
+    mov     r0, #btn_count
+    mov     r1, #2*BUTTONS ; btn_count and btn_time
+Buttons_Init_clear:
+    mov     @r0, #0
+    inc     r0
+    djnz    r1, Buttons_Init_clear
+    mov     btn_tick, #10
+    mov     btn_head, #0
+    mov     btn_tail, #0
+    ret
 
-show_alarm_on:
-    Set_Cursor(2,14)
-    Send_Constant_String(#alarm_on)
+; a = the next event from Timer2_ISR, 0xFF for none
+Button_Get:
+    mov     a, btn_tail
+    cjne    a, btn_head, Button_Get_one
+    mov     a, #0xFF
+    ret
+Button_Get_one:
+    add     a, #btn_queue
+    mov     r0, a
+    mov     a, btn_tail
+    inc     a
+    anl     a, #BTN_QUEUE_LEN-1
+    mov     r1, a
+    mov     a, @r0 ; Before the slot is given back
+    mov     btn_tail, r1
+    ret
 
+; Event a from Button_Get
+Button_Event:
+    cjne    a, #EV_PRESS+BTN_ALARM, Button_Event_1
+    ljmp    Alarm_Press
+Button_Event_1:
+    cjne    a, #EV_HOLD+BTN_ALARM, Button_Event_2
+    ljmp    Alarm_Hold
+Button_Event_2:
+    cjne    a, #EV_RELEASE+BTN_ALARM, Button_Event_3
+    ljmp    Alarm_Release
+Button_Event_3:
+    cjne    a, #EV_PRESS+BTN_AMPM, Button_Event_4
+    ljmp    Ampm_Press
+Button_Event_4:
+    cjne    a, #EV_HOLD+BTN_CLEAR, Button_Event_5
+    ljmp    Clear_Hold
+Button_Event_5:
+    cjne    a, #EV_RELEASE+BTN_CLEAR, Button_Event_6
+    ljmp    Clear_Release
+Button_Event_6:
+    cjne    a, #EV_PRESS+BTN_HOURS, Button_Event_7
+    ljmp    Hours_Press
+Button_Event_7:
+    cjne    a, #EV_PRESS+BTN_MINUTES, Button_Event_8
+    ljmp    Minutes_Press
+Button_Event_8:
+    cjne    a, #EV_PRESS+BTN_SECONDS, Button_Event_done
+    ljmp    Seconds_Press
+Button_Event_done:
+    ret
+
+; ALARM stops an alarm that is ringing, and that press does nothing else.
+; Otherwise let go it turns the alarm shown on or off, and held it shows
+; the next one of the table.
+Alarm_Press:
+    jnb     ringing, Alarm_Press_done
+    clr     ringing
+    setb    alarm_stopped
+Alarm_Press_done:
+    ret
 
-;-------------------------------AMPM TOGGLE CHECK (polling)------------------------;
+Alarm_Hold:
+    jbc     alarm_stopped, Alarm_Hold_done
+    ljmp    Alarm_Select
+Alarm_Hold_done:
+    ret
 
-AMPM_check_routine:
-    jb      AMPM_BUTTON, check_clear 
-    Wait_Milli_Seconds(#50)
-    jb      AMPM_BUTTON, check_clear
-    jnb     AMPM_BUTTON, $ ; wait for release
+Alarm_Release:
+    jbc     alarm_stopped, Alarm_Release_done
+    jb      trim_mode, Alarm_Release_melody
+    cpl     alarm_toggle ; compliment the variable
+    setb    alarm_edit
+Alarm_Release_done:
+    ret
+Alarm_Release_melody:
+    ; trim mode: the next melody, played once to hear it
+    mov     a, melody
+    inc     a
+    anl     a, #MELODY_COUNT-1
+    mov     melody, a
+    setb    trim_dirty
+    setb    melody_once
+    ljmp    Melody_Start
+
+Ampm_Press:
+    jnb     ringing, ampm_not_ringing
+    ljmp    Snooze_Start ; Ringing: snooze
+
+ampm_not_ringing:
+    jnb     trim_mode, ampm_not_trim
+    cpl     trim_neg ; trim mode: flip the sign
+    setb    trim_dirty
+    ret
 
+ampm_not_trim:
     jb      alarm_toggle, toggle_alarm_ampm_man
     cpl     clock_AMPM_toggle
-    sjmp    check_clear
+    setb    clock_edit
+    ret
 
 toggle_alarm_ampm_man:
     cpl     alarm_AMPM_toggle
+    setb    alarm_edit
+    ret
 
-
-;--------------------------------CLEAR BUTTON CHECK (polling)-----------------------------------------------;
-
-check_clear:
-
-    jb 		CLEAR_BUTTON, loop_a  ; if (CLEAR_BUTTON) skip
-    Wait_Milli_Seconds(#50) ; Debounce delay.  
-    jb 		CLEAR_BUTTON, loop_a  ; another check
-    jnb 	CLEAR_BUTTON, $     ; Wait for button release.  
+; CLEAR held for TRIM_HOLD: trim mode on/off instead of a clear
+Clear_Hold:
+    ljmp    Trim_Mode_Toggle
+
+Clear_Release:
+    jb      trim_mode, clear_seconds
+    jnb     alarm_toggle, clear_seconds
+    ; Alarm mode: the next snooze, 0 (none) to 9 minutes
+    mov     a, alarm_snooze
+    inc     a
+    cjne    a, #10, clear_snooze
+    clr     a
+clear_snooze:
+    mov     alarm_snooze, a
+    setb    alarm_edit
+    ret
+clear_seconds:
     ; A valid press of the 'CLEAR' button has been detected, reset the BCD counter.
     clr 	TR2                 ; Stop timer 2
     clr 	a
@@ -389,96 +1670,19 @@ check_clear:
     ; Now clear the BCD counter
     mov 	seconds, a
     setb 	TR2                ; Start timer 2
-    sjmp 	loop_b              ; Display the new value
-loop_a:
-    jb 		seconds_flag, loop_b  ; If flag is set, jump over the long jump to the display code
-    ljmp 	loop                ; Otherwise, use a Long Jump to reach the distant top
-loop_b:
-
-    clr 	seconds_flag     ; We clear this flag in the main loop, but it is set in the ISR for timer 2
-
-    Set_Cursor(1, 7)
-    Display_BCD(hours)
-
-    Set_Cursor(1, 10)
-    Display_BCD(minutes)
-
-    Set_Cursor(1, 13)    
-    Display_BCD(seconds) 
-
-    Set_Cursor(1, 15)
-    jb clock_AMPM_toggle, show_clock_pm_str
-    Send_Constant_String(#clock_AM)
-    sjmp display_alarm_data
-
-show_clock_pm_str:
-    Send_Constant_String(#clock_PM)
-
-display_alarm_data:
-    Set_Cursor(2, 7)
-    Display_BCD(alarm_hours)
-
-    Set_Cursor(2, 10)
-    Display_BCD(alarm_minutes)
-
-    Set_Cursor(2, 12)
-    jb alarm_AMPM_toggle, show_alarm_pm_str
-    Send_Constant_String(#alarm_AM)
-    sjmp alarm_compare_logic_label
-show_alarm_pm_str:
-    Send_Constant_String(#alarm_PM)
-
-;-----------------------ALARM COMPARISON-----------------------------------;
-alarm_compare_logic_label:
-    mov         a, hours
-    cjne        a, alarm_hours, alarm_beep_stop 
-    
-    mov         a, minutes
-    cjne        a, alarm_minutes, alarm_beep_stop 
-
-    jb          clock_AMPM_toggle, check_pm_match
-    jb          alarm_AMPM_toggle, alarm_beep_stop  
-    sjmp        check_alarm_enabled                    
-
-check_pm_match:
-    jnb         alarm_AMPM_toggle, alarm_beep_stop  
-
-check_alarm_enabled:
-    ; If alarm_toggle is 0 (OFF), we jump to stop beeping immediately
-    ; even though the hours/minutes/AMPM match perfectly.
-    jnb         alarm_toggle, alarm_beep_stop
-
-start_the_beep:
-    setb        ET0 ; Enable sound interrupt
-    setb        P1.0 ; Enable LED Blinker
-    ljmp        loop
-
-alarm_beep_stop:  
-    clr         ET0 ; Disable sound interrupt 
-    clr         SOUND_OUT ; Force speaker pin low to stop buzz
-    clr         P1.0 ; Turn off LED Blinker
-    ljmp        loop
-        
-;----------------------PINS (1.1, 1.2, and 1.6) GENERAL INTERRUPT ISR---------------;
-; all pin interrupts will jump here and so then we'll use a controller to poll which pin it was using PIF register
-
-PINS_ISR:
-    push    ACC
-    push    psw
+    ret
 
-    mov     a, PIF     ; copy the flags into a
-    mov     PIF, #0x00 ; clear flags via software as stated in DS
-    
-    ; checking for PIF6, P1.6, which is pin 8, for the minutes 
-    mov     b, a ; Keep a copy for ELIF_seconds
-    anl     a, #01000000B
-    jz      ELIF_seconds ; if PIF6 is 0, skip to seconds check
+Minutes_Press:
+    jnb     trim_mode, minutes_not_trim
+    mov     a, #0x01 ; trim mode: +1 ppm
+    ljmp    Trim_Add
 
-; fall through if equal
-IF_minutes:
+minutes_not_trim:
     ; if alarm mode bit = 1, then we want to change the alarm
     jb      alarm_toggle, IF_alarm_minutes
 
+    setb    clock_edit
+    clr     EA ; Timer2_ISR moves the minutes too
     mov     a, minutes 
     add     a, #0x01
     da      a
@@ -489,9 +1693,11 @@ IF_minutes:
     mov     minutes, #0x00
 
 minutes_done:
-    sjmp    PINS_ISR_DONE
+    setb    EA
+    ret
 
 IF_alarm_minutes:
+    setb    alarm_edit
     ; first increment the minutes and check for rollover
     mov     a, alarm_minutes
     add     a, #0x01    
@@ -502,25 +1708,35 @@ IF_alarm_minutes:
     mov     alarm_minutes, #0x0
 
 alarm_minutes_done:
-    sjmp    PINS_ISR_DONE
+    ret
 
+Seconds_Press:
+    jnb     trim_mode, seconds_not_trim
+    clr     EA
+    lcall   Next_Day ; trim mode: the day of the week
+    setb    EA
+    ret
 
-ELIF_seconds: ; poll pin 15 (seconds adjust button)
-    mov     a, b
-    anl     a, #00000010B ; Check Bit 1 (P1.1)
-    jz      PINS_ISR_DONE
+seconds_not_trim:
+    jnb     alarm_toggle, seconds_clock
+    mov     a, alarm_repeat ; alarm mode: the next repeat
+    inc     a
+    anl     a, #0x03
+    mov     alarm_repeat, a
+    setb    alarm_edit
+    ret
 
+seconds_clock:
+    clr     EA
     mov     a, seconds
     add     a, #0x01        ; add 1 to the seconds counter
     da      a               ; decima adjust
     mov     seconds, a      ; put the updated value back into seconds variable 
 
-    cjne    a, #0x60, PINS_ISR_DONE ; Check rollover at 60
+    cjne    a, #0x60, seconds_set ; Check rollover at 60
     mov     seconds, #0x00
-    
-PINS_ISR_DONE:
-    pop 	psw
-    pop 	ACC
-    reti
+seconds_set:
+    setb    EA
+    ret
 
 END
@@ -0,0 +1,58 @@
+// timebase.c:  Free-running Timer3 timebase shared by the EFM8LB1 programs
+
+#include <EFM8LB1.h>
+#include "timebase.h"
+
+volatile unsigned long tb_ms;
+
+void Timebase_Init (void)
+{
+	TMR3CN0 = 0x00;          // Stop; T3XCLK = 0: SYSCLK/12
+	CKCON0 &= 0b_0011_1111;  // T3MH = T3ML = 0: clock from T3XCLK
+	TMR3RL  = TB_RELOAD;
+	TMR3    = TB_RELOAD;
+	tb_ms   = 0;
+	EIE1   |= 0b_1000_0000;  // ET3
+	TMR3CN0 = 0x04;          // TR3
+}
+
+void Timer3_ISR (void) interrupt INTERRUPT_TIMER3
+{
+	SFRPAGE = 0x0;
+	TMR3CN0 &= ~0x80;        // TF3H
+	tb_ms++;
+}
+
+unsigned long Ticks (void)
+{
+	unsigned long t;
+
+	TB_TICKS(t);
+	return t;
+}
+
+unsigned long Micros (void)
+{
+	unsigned long ms;
+	unsigned int n;
+
+	TB_READ(ms, n);
+	return ms * 1000L + n / TB_TICKS_PER_US;
+}
+
+bit Expired (unsigned long deadline)
+{
+	return (long)(Ticks() - deadline) >= 0;
+}
+
+void Delay_us (unsigned int us)
+{
+	unsigned long deadline = Ticks() + (unsigned long)us * TB_TICKS_PER_US;
+	while (!Expired(deadline));
+}
+
+void waitms (unsigned int ms)
+{
+	unsigned long deadline = Ticks() + (unsigned long)ms * TB_TICKS_PER_MS;
+	while (!Expired(deadline));
+}
@@ -0,0 +1,56 @@
+// timebase.h:  Free-running Timer3 timebase shared by the EFM8LB1 programs
+//
+// Timer3 counts SYSCLK/12 (6 ticks per us) and reloads every millisecond;
+// its interrupt counts the milliseconds.  Together they give a 32-bit tick
+// count, microseconds, deadlines and delays that neither drift nor
+// reprogram a timer on every call.  Timer3 belongs to this module, and
+// it needs EA = 1.
+
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#define TB_SYSCLK       72000000L  // Must match the program's SYSCLK
+#define TB_TICKS_PER_US (TB_SYSCLK/12L/1000000L)
+#define TB_TICKS_PER_MS (TB_SYSCLK/12L/1000L)
+#define TB_RELOAD       (0x10000L - TB_TICKS_PER_MS)
+
+extern volatile unsigned long tb_ms;  // Milliseconds since Timebase_Init()
+
+// ms = tb_ms and n = Timer3 ticks into that millisecond, read together.
+// A Timer3 overflow not yet counted by its ISR (still pending, or the
+// reader is itself an ISR) is added when TMR3 shows it came before the
+// read.  Interrupt routines use this macro directly: C51 functions must
+// not be called from both main and an ISR.
+#define TB_READ(ms, n) \
+{ \
+	unsigned char h_, l_; \
+	do { \
+		(ms) = tb_ms; \
+		do { \
+			h_ = TMR3H; \
+			l_ = TMR3L; \
+		} while (h_ != TMR3H); \
+		(n) = (((unsigned int)h_ << 8) | l_) - (unsigned int)TB_RELOAD; \
+		if ((TMR3CN0 & 0x80) && ((n) < TB_TICKS_PER_MS / 2)) (n) += TB_TICKS_PER_MS; \
+	} while ((ms) != tb_ms); \
+}
+
+// t = Ticks() now.  The 32-bit multiply is a call into the C51 library,
+// which is not reentrant either: not for ISRs, which keep the TB_READ()
+// pair and convert it in main.
+#define TB_TICKS(t) \
+{ \
+	unsigned long tms_; \
+	unsigned int tn_; \
+	TB_READ(tms_, tn_); \
+	(t) = tms_ * TB_TICKS_PER_MS + tn_; \
+}
+
+void Timebase_Init (void);
+unsigned long Ticks (void);               // SYSCLK/12 ticks, wraps after ~12 min
+unsigned long Micros (void);              // Microseconds, wraps after ~71 min
+bit  Expired (unsigned long deadline);    // Ticks() has reached deadline
+void Delay_us (unsigned int us);
+void waitms (unsigned int ms);
+
+#endif
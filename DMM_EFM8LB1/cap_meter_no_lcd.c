@@ -2,16 +2,48 @@
 //
 // By:  Jesus Calvino-Fraga (c) 2008-2018
 //
+// Reciprocal counting: T0 counts every falling edge, and PCA0 module 0
+// timestamps the first edge after the gate opens and the first edge after
+// it closes, at SYSCLK.  Timer2 times the gate; the whole reading runs in
+// interrupts while the main loop prints the previous one.  f = edges /
+// exact time between those two edges, so the resolution is one SYSCLK
+// tick in the gate (7e-7 for GATE_MS) at any frequency where the edges
+// are further apart than the ISR's read of both counters.  The edge that
+// closes a gate opens the next, so a reading takes GATE_MS rounded up to
+// whole periods: one a period below 50 Hz (10/s at 10 Hz), 25-50/s above.
+//
+// Wiring: the signal goes to P0.0 (CEX0) with a jumper to P0.1 (T0).
+// Enabling CEX0 in the crossbar pushes T0 from P0.0 to P0.1.
+//
 // The next line clears the "C51 command line options:" field when compiling with CrossIDE
 //  ~C51~
   
 #include <EFM8LB1.h>
+#include "../COMMON_EFM8LB1/timebase.h"
 #include <stdio.h>
 
 #define SYSCLK      72000000L  // SYSCLK frequency in Hz
 #define BAUDRATE      115200L  // Baud rate of UART in bps
+#define GATE_MS            20  // Shortest gate
+#define TIMEOUT_MS       2000  // Longest wait for an edge: 0.5 Hz minimum
+
+// Arm the capture interrupt for the next edge, for at most TIMEOUT_MS
+// (a macro: it runs in the Timer2 ISR as well as in main)
+#define ARM_EDGE() { CCF0=0; PCA0CPM0|=0b_0000_0001; gate_ms=TIMEOUT_MS; }
 
-unsigned char overflow_count;
+// gate_state
+#define GATE_FIRST 0  // Waiting for the edge that opens the gate
+#define GATE_OPEN  1  // Gate running for GATE_MS
+#define GATE_LAST  2  // Waiting for the edge that closes it
+#define GATE_DONE  3  // gate_t1/n1 .. gate_t2/n2 valid
+#define GATE_NONE  4  // No edge within TIMEOUT_MS
+
+volatile unsigned int t0_overflows;  // Upper 16 bits of the T0 edge count
+volatile unsigned int pca_overflows; // Upper 16 bits of the SYSCLK count
+volatile unsigned char gate_state=GATE_NONE;
+volatile unsigned int gate_ms;       // ms left in this state, Timer2 ISR
+// Opening and closing edges: SYSCLK ticks and T0 count
+unsigned long gate_t1, gate_n1, gate_t2, gate_n2;
 
 char _c51_external_startup (void)
 {
@@ -63,7 +95,7 @@ char _c51_external_startup (void)
 	
 	P0MDOUT |= 0x10; // Enable UART0 TX as push-pull output
 	XBR0     = 0x01; // Enable UART0 on P0.4(TX) and P0.5(RX)                     
-	XBR1     = 0X10; // Enable T0 on P0.0
+	XBR1     = 0X11; // Enable CEX0 on P0.0 and T0 on P0.1
 	XBR2     = 0x40; // Enable crossbar and weak pull-ups
 
 	#if (((SYSCLK/BAUDRATE)/(2L*12L))>0xFFL)
@@ -82,59 +114,164 @@ char _c51_external_startup (void)
 	return 0;
 }
  
-// Uses Timer3 to delay <us> micro-seconds. 
-void Timer3us(unsigned char us)
+// Timer/Counter 0 counts edges without stopping; its overflow interrupt
+// extends the count to 32 bits, so no overflow is missed or aliased at
+// any input rate the pin accepts.
+void TIMER0_Init(void)
 {
-	unsigned char i;               // usec counter
-	
-	// The input for Timer 3 is selected as SYSCLK by setting T3ML (bit 6) of CKCON0:
-	CKCON0|=0b_0100_0000;
-	
-	TMR3RL = (-(SYSCLK)/1000000L); // Set Timer3 to overflow in 1us.
-	TMR3 = TMR3RL;                 // Initialize Timer3 for first overflow
-	
-	TMR3CN0 = 0x04;                 // Sart Timer3 and clear overflow flag
-	for (i = 0; i < us; i++)       // Count <us> overflows
+	TMOD&=0b_1111_0000; // Set the bits of Timer/Counter 0 to zero
+	TMOD|=0b_0000_0101; // Timer/Counter 0 used as a 16-bit counter
+	TR0=0; // Stop Timer/Counter 0
+	TMR0=0;
+	t0_overflows=0;
+	TF0=0;
+	ET0=1;
+	TR0=1; // Start Timer/Counter 0
+}
+
+void Timer0_ISR (void) interrupt INTERRUPT_TIMER0
+{
+	t0_overflows++;
+}
+
+// Timer2 ticks every 1 ms (SYSCLK/12, auto-reload) and times the gate
+// and the edge timeouts, independently of the main loop
+void TIMER2_Init(void)
+{
+	TMR2CN0=0x00;        // Stop Timer2, SYSCLK/12
+	TMR2RL=-(SYSCLK/12L/1000L);
+	TMR2=TMR2RL;
+	ET2=1;
+	TR2=1;
+}
+
+// PCA0 counts SYSCLK, extended to 32 bits by its overflow interrupt.
+// Module 0 captures every falling edge on CEX0 (the edges T0 counts);
+// its interrupt is only enabled while the gate waits for an edge.
+void PCA0_Init(void)
+{
+	CR=0;
+	PCA0MD=0b_0000_1001;   // CPS = SYSCLK, ECF = 1 (overflow interrupt)
+	PCA0CPM0=0b_0001_0000; // CAPN: capture on negative edges
+	PCA0=0;
+	pca_overflows=0;
+	EIE1|=0b_0001_0000;    // EPCA0
+	CR=1;
+}
+
+void PCA0_ISR (void) interrupt INTERRUPT_PCA0
+{
+	unsigned int hi, cap;
+	unsigned char th, tl, tries;
+	unsigned long ticks, count;
+
+	SFRPAGE=0x0;
+	if (CCF0)
 	{
-		while (!(TMR3CN0 & 0x80));  // Wait for overflow
-		TMR3CN0 &= ~(0x80);         // Clear overflow indicator
-		if (TF0)
+		CCF0=0;
+		PCA0CPM0&=~0b_0000_0001; // One edge per ARM_EDGE()
+		// T0 is read an interrupt latency after the capture.  CAPN still
+		// captures every edge, so a capture that changed meanwhile is an
+		// edge T0 may have counted: take it instead, and read T0 again.
+		tries=4;
+		do {
+			cap=PCA0CP0;
+			do {
+				th=TH0;
+				tl=TL0;
+			} while (th!=TH0);
+		} while ((cap!=PCA0CP0) && --tries);
+		// An overflow still pending came before a small capture value
+		hi=pca_overflows;
+		if (CF && (cap<0x8000)) hi++;
+		ticks=((unsigned long)hi<<16)|cap;
+		// T0 count at the edge, same rule for a pending T0 overflow
+		hi=t0_overflows;
+		if (TF0 && (th<0x80)) hi++;
+		count=((unsigned long)hi<<16)|((unsigned int)th<<8)|tl;
+
+		if (gate_state==GATE_FIRST)
 		{
-		   TF0=0;
-		   overflow_count++;
+			gate_t1=ticks;
+			gate_n1=count;
+			gate_ms=GATE_MS;
+			gate_state=GATE_OPEN;
+		}
+		else if (gate_state==GATE_LAST)
+		{
+			gate_t2=ticks;
+			gate_n2=count;
+			gate_ms=0;
+			gate_state=GATE_DONE;
 		}
 	}
-	TMR3CN0 = 0 ;                   // Stop Timer3 and clear overflow flag
+	if (CF)
+	{
+		CF=0;
+		pca_overflows++;
+	}
 }
 
-void waitms (unsigned int ms)
+void Timer2_ISR (void) interrupt INTERRUPT_TIMER2
 {
-	unsigned int j;
-	for(j=ms; j!=0; j--)
+	SFRPAGE=0x0;
+	TF2H=0;
+	if (gate_ms==0 || --gate_ms!=0) return;
+	switch (gate_state)
 	{
-		Timer3us(249);
-		Timer3us(249);
-		Timer3us(249);
-		Timer3us(250);
+		case GATE_OPEN:  // Gate over: the next edge closes it
+			gate_state=GATE_LAST;
+			ARM_EDGE();
+			break;
+		case GATE_FIRST:
+		case GATE_LAST:  // No edge in time
+			PCA0CPM0&=~0b_0000_0001;
+			gate_state=GATE_NONE;
+			break;
 	}
 }
 
-void TIMER0_Init(void)
+// Start a reading; it runs in the ISRs until gate_state >= GATE_DONE.
+// After a reading the edge that closed it opens this one.
+void Gate_Start (void)
 {
-	TMOD&=0b_1111_0000; // Set the bits of Timer/Counter 0 to zero
-	TMOD|=0b_0000_0101; // Timer/Counter 0 used as a 16-bit counter
-	TR0=0; // Stop Timer/Counter 0
+	ET2=0;
+	if (gate_state==GATE_DONE)
+	{
+		gate_t1=gate_t2;
+		gate_n1=gate_n2;
+		gate_ms=GATE_MS;
+		gate_state=GATE_OPEN;
+	}
+	else
+	{
+		gate_state=GATE_FIRST;
+		ARM_EDGE();
+	}
+	ET2=1;
+}
+
+// Edges between the two timestamped edges over the exact time between
+// them.  0 if there was no signal.
+float Gate_Frequency (void)
+{
+	if (gate_state!=GATE_DONE) return 0;
+	return (float)(gate_n2-gate_n1)*SYSCLK/(float)(gate_t2-gate_t1);
 }
 
 void main (void) 
 {
-    unsigned long F;
+    float F;
     // --- ADDED VARIABLES ---
     float Ra = 1648.0; // Use your actual measured value from the lab
     float Rb = 1647.0; // Use your actual measured value from the lab
     float C;
     
     TIMER0_Init();
+    TIMER2_Init();
+    PCA0_Init();
+    Timebase_Init();
+    EA=1;
 
     waitms(500); // Give PuTTY a chance to start.
     printf("\x1b[2J"); // Clear screen using ANSI escape sequence.
@@ -144,26 +281,22 @@ void main (void)
             "Compiled: %s, %ss\n\n",
             __FILE__, __DATE__, __TIME__);
 
+    Gate_Start();
     while(1)
     {
-        TL0=0;
-        TH0=0;
-        overflow_count=0;
-        TF0=0;
-        TR0=1; // Start Timer/Counter 0
-        waitms(1000);
-        TR0=0; // Stop Timer/Counter 0
-        F=overflow_count*0x10000L+TH0*0x100L+TL0;
+        while (gate_state<GATE_DONE); // Reading runs in the ISRs
+        F=Gate_Frequency();
+        Gate_Start(); // Next reading counts while this one prints
 
         // --- calculation for capacitance ---
         if (F > 0)  
         {
             // C = 1.44 / ((Ra + 2Rb) * f)
-            C = 1.44 / ((Ra + 2.0 * Rb) * (float)F);
+            C = 1.44 / ((Ra + 2.0 * Rb) * F);
            
             
             // print frequency in Hz and capacitance in nF (C * 1e9)
-            printf("\rf = %lu Hz, C = %.2f nF", F, C * 1000000000.0);
+            printf("\rf = %.4f Hz, C = %.2f nF", F, C * 1000000000.0);
         }
         else 
         {
@@ -1,40 +1,14 @@
 //  LCD in 4-bit interface mode
+//  Delays come from the shared timebase: call Timebase_Init() at startup
 #include <EFM8LB1.h>
 #include "lcd.h"
 #include "global.h"
-
-// Uses Timer3 to delay <us> micro-seconds. 
-void Timer3us(unsigned char us)
-{
-	unsigned char i;               // usec counter
-	
-	// The input for Timer 3 is selected as SYSCLK by setting T3ML (bit 6) of CKCON0:
-	CKCON0|=0b_0100_0000;
-	
-	TMR3RL = (-(SYSCLK)/1000000L); // Set Timer3 to overflow in 1us.
-	TMR3 = TMR3RL;                 // Initialize Timer3 for first overflow
-	
-	TMR3CN0 = 0x04;                 // Sart Timer3 and clear overflow flag
-	for (i = 0; i < us; i++)       // Count <us> overflows
-	{
-		while (!(TMR3CN0 & 0x80));  // Wait for overflow
-		TMR3CN0 &= ~(0x80);         // Clear overflow indicator
-	}
-	TMR3CN0 = 0 ;                   // Stop Timer3 and clear overflow flag
-}
-
-void waitms (unsigned int ms)
-{
-	unsigned int j;
-	unsigned char k;
-	for(j=0; j<ms; j++)
-		for (k=0; k<4; k++) Timer3us(250);
-}
+#include "../COMMON_EFM8LB1/timebase.h"
 
 void LCD_pulse (void)
 {
 	LCD_E=1;
-	Timer3us(40);
+	Delay_us(40);
 	LCD_E=0;
 }
 
@@ -47,7 +21,7 @@ void LCD_byte (unsigned char x)
 	LCD_D5=ACC_5;
 	LCD_D4=ACC_4;
 	LCD_pulse();
-	Timer3us(40);
+	Delay_us(40);
 	ACC=x; //Send low nible
 	LCD_D7=ACC_3;
 	LCD_D6=ACC_2;
@@ -7,6 +7,13 @@ BAUD              EQU 115200
 TIMER1_RELOAD     EQU (0x100-(CLK/(16*BAUD)))
 TIMER0_RELOAD_1MS EQU (0x10000-(CLK/1000))
 TEMP_THRESHOLD    EQU 3000
+OVERSAMPLE        EQU 64   ; Conversions a block, 1ms apart: 4^3 ...
+DECIMATE          EQU 3    ; ... for 3 more bits, 15 in all
+REF_EVERY         EQU 8    ; Sensor blocks to each LM4040 block
+REF_SHIFT         EQU 3    ; LM4040 filter: 1/8 of each new block
+SEN_SHIFT         EQU 2    ; Sensor filter: 1/4 of each new block
+TREND_HYST        EQU 5    ; 0.05 C past the last turn before the LEDs change
+TREND_IDLE        EQU 45   ; Updates inside that before both LEDs go off
 
 ORG 0x0000
     ljmp main
@@ -30,6 +37,12 @@ y:          ds 4
 bcd:        ds 5
 VAL_LM4040: ds 2
 last_temp:  ds 4
+ref_filt:   ds 4
+sen_filt:   ds 4
+temp_now:   ds 4
+filt_new:   ds 4
+ref_count:  ds 1
+trend_idle: ds 1
 
 BSEG
 mf: dbit 1
@@ -99,30 +112,111 @@ Read_ADC:
     mov R0, A
     ret
 
-main:
-    mov sp, #0x7f
-    lcall Init_All
-    lcall LCD_4BIT
+; x = x >> R3
+Shift_x_right:
+    clr c
+    mov a, x+3
+    rrc a
+    mov x+3, a
+    mov a, x+2
+    rrc a
+    mov x+2, a
+    mov a, x+1
+    rrc a
+    mov x+1, a
+    mov a, x+0
+    rrc a
+    mov x+0, a
+    djnz R3, Shift_x_right
+    ret
 
-    Set_Cursor(1, 1)
-    Send_Constant_String(#test_message)
-    Set_Cursor(2, 1)
-    Send_Constant_String(#value_message)
+; x = OVERSAMPLE conversions of the channel in ADCCON0 added up, shifted
+; right DECIMATE.  The first after the channel change is thrown away.
+Oversample:
+    lcall Read_ADC
+    clr a
+    mov x+0, a
+    mov x+1, a
+    mov x+2, a
+    mov x+3, a
+    mov R3, #OVERSAMPLE
+Oversample_loop:
+    lcall wait_1ms
+    lcall Read_ADC
+    mov a, x+0
+    add a, R0
+    mov x+0, a
+    mov a, x+1
+    addc a, R1
+    mov x+1, a
+    mov a, x+2
+    addc a, #0
+    mov x+2, a
+    djnz R3, Oversample_loop
+    mov R3, #DECIMATE
+    ljmp Shift_x_right
 
-Forever:
+Read_Ref:
     anl ADCCON0, #0xF0
     orl ADCCON0, #0x00
-    lcall Read_ADC
-    mov VAL_LM4040+0, R0
-    mov VAL_LM4040+1, R1
+    ljmp Oversample
 
+Read_Sensor:
     anl ADCCON0, #0xF0
     orl ADCCON0, #0x07
-    lcall Read_ADC
-    mov x+0, R0
-    mov x+1, R1
-    mov x+2, #0
-    mov x+3, #0
+    ljmp Oversample
+
+; x = x - (x >> R3) + y: a step of a filter whose state, x, is the average
+; times 2^R3
+Filter:
+    mov filt_new+0, y+0
+    mov filt_new+1, y+1
+    mov filt_new+2, y+2
+    mov filt_new+3, y+3
+    mov y+0, x+0
+    mov y+1, x+1
+    mov y+2, x+2
+    mov y+3, x+3
+    lcall Shift_x_right
+    mov a, x+0
+    xch a, y+0
+    mov x+0, a
+    mov a, x+1
+    xch a, y+1
+    mov x+1, a
+    mov a, x+2
+    xch a, y+2
+    mov x+2, a
+    mov a, x+3
+    xch a, y+3
+    mov x+3, a
+    lcall sub32
+    mov y+0, filt_new+0
+    mov y+1, filt_new+1
+    mov y+2, filt_new+2
+    mov y+3, filt_new+3
+    ljmp add32
+
+; VAL_LM4040 = the LM4040 filter's average
+Ref_Average:
+    mov x+0, ref_filt+0
+    mov x+1, ref_filt+1
+    mov x+2, ref_filt+2
+    mov x+3, ref_filt+3
+    mov R3, #REF_SHIFT
+    lcall Shift_x_right
+    mov VAL_LM4040+0, x+0
+    mov VAL_LM4040+1, x+1
+    ret
+
+; x = temperature in 0.01 C from the filtered sensor and LM4040
+Temperature:
+    mov x+0, sen_filt+0
+    mov x+1, sen_filt+1
+    mov x+2, sen_filt+2
+    mov x+3, sen_filt+3
+    mov R3, #SEN_SHIFT
+    lcall Shift_x_right
     Load_y(41290)
     lcall mul32
     mov y+0, VAL_LM4040+0
@@ -131,7 +225,79 @@ Forever:
     mov y+3, #0
     lcall div32
     Load_y(27314)
-    lcall sub32
+    ljmp sub32
+
+main:
+    mov sp, #0x7f
+    lcall Init_All
+    lcall LCD_4BIT
+
+    Set_Cursor(1, 1)
+    Send_Constant_String(#test_message)
+    Set_Cursor(2, 1)
+    Send_Constant_String(#value_message)
+
+    ; Both filters start from a block, settled
+    lcall Read_Ref
+    Load_y(1<<REF_SHIFT)
+    lcall mul32
+    mov ref_filt+0, x+0
+    mov ref_filt+1, x+1
+    mov ref_filt+2, x+2
+    mov ref_filt+3, x+3
+    lcall Ref_Average
+    lcall Read_Sensor
+    Load_y(1<<SEN_SHIFT)
+    lcall mul32
+    mov sen_filt+0, x+0
+    mov sen_filt+1, x+1
+    mov sen_filt+2, x+2
+    mov sen_filt+3, x+3
+    lcall Temperature
+    mov last_temp+0, x+0
+    mov last_temp+1, x+1
+    mov last_temp+2, x+2
+    mov last_temp+3, x+3
+    mov ref_count, #REF_EVERY
+    mov trend_idle, #TREND_IDLE
+
+Forever:
+    djnz ref_count, Forever_Sensor
+    mov ref_count, #REF_EVERY
+    lcall Read_Ref
+    mov y+0, x+0
+    mov y+1, x+1
+    mov y+2, x+2
+    mov y+3, x+3
+    mov x+0, ref_filt+0
+    mov x+1, ref_filt+1
+    mov x+2, ref_filt+2
+    mov x+3, ref_filt+3
+    mov R3, #REF_SHIFT
+    lcall Filter
+    mov ref_filt+0, x+0
+    mov ref_filt+1, x+1
+    mov ref_filt+2, x+2
+    mov ref_filt+3, x+3
+    lcall Ref_Average
+
+Forever_Sensor:
+    lcall Read_Sensor
+    mov y+0, x+0
+    mov y+1, x+1
+    mov y+2, x+2
+    mov y+3, x+3
+    mov x+0, sen_filt+0
+    mov x+1, sen_filt+1
+    mov x+2, sen_filt+2
+    mov x+3, sen_filt+3
+    mov R3, #SEN_SHIFT
+    lcall Filter
+    mov sen_filt+0, x+0
+    mov sen_filt+1, x+1
+    mov sen_filt+2, x+2
+    mov sen_filt+3, x+3
+    lcall Temperature
 
     Load_y(TEMP_THRESHOLD)
     lcall x_gt_y
@@ -141,44 +307,56 @@ Forever:
 Drive_High:
     setb P0.4
 
+; The LEDs change once the temperature is TREND_HYST past last_temp, the
+; last turn, and go off after TREND_IDLE updates with no change
 Check_Trend:
+    mov temp_now+0, x+0
+    mov temp_now+1, x+1
+    mov temp_now+2, x+2
+    mov temp_now+3, x+3
     mov y+0, last_temp+0
     mov y+1, last_temp+1
     mov y+2, last_temp+2
     mov y+3, last_temp+3
+    lcall sub32
+    Load_y(TREND_HYST)
+    lcall add32
+    mov a, x+3
+    jb acc.7, Temp_Falling
+    Load_y(2*TREND_HYST)
     lcall x_gt_y
     jb mf, Temp_Rising
-    lcall x_lt_y
-    jb mf, Temp_Falling
+    djnz trend_idle, Save_History
     clr P1.5
     clr P1.6
     sjmp Save_History
 Temp_Rising:
     setb P1.5
     clr P1.6
-    sjmp Save_History
+    sjmp Trend_Moved
 Temp_Falling:
     clr P1.5
     setb P1.6
+Trend_Moved:
+    mov last_temp+0, temp_now+0
+    mov last_temp+1, temp_now+1
+    mov last_temp+2, temp_now+2
+    mov last_temp+3, temp_now+3
+    mov trend_idle, #TREND_IDLE
 
 Save_History:
+    mov x+0, temp_now+0
+    mov x+1, temp_now+1
+    mov x+2, temp_now+2
+    mov x+3, temp_now+3
     lcall hex2bcd
     Set_Cursor(2, 7)
     Display_BCD(bcd+1)
     Display_char(#'.')
     Display_BCD(bcd+0)
 
-    mov last_temp+0, x+0
-    mov last_temp+1, x+1
-    mov last_temp+2, x+2
-    mov last_temp+3, x+3
-
     lcall Send_PC
 
-    mov R2, #250
-    lcall waitms
-    mov R2, #250
-    lcall waitms
     ljmp Forever
 
 Send_PC: